@@ -70,8 +70,8 @@ static struct {
 	AGLDrawMerge merge;
 	AGLDrawTarget screen, fb;
 
-	AGLTexture fbtex;
-	AGLFramebuffer fbo;
+	/* Offscreen target, acquired from the pool every frame */
+	AGLRenderTarget *rt;
 	AGLClearParams clear;
 
 	float resolution[2];
@@ -90,17 +90,6 @@ static void init(void) {
 		/* \fixme add fatal */
 	}
 
-	g.fbtex = aGLTextureCreate(&(AGLTextureData) {
-			.type = AGLTT_2D,
-			.format = AGLTF_U8_RGBA,
-			.x = 0,
-			.y = 0,
-			.width = a_app_state->width,
-			.height = a_app_state->height,
-			.pixels = 0,
-		}
-	);
-
 	g.clear.r = g.clear.g = g.clear.b = g.clear.a = 0;
 	g.clear.depth = 1;
 	g.clear.bits = AGLCB_Color;
@@ -152,7 +141,7 @@ static void init(void) {
 
 	g.shuni[1].name = "us2_texture";
 	g.shuni[1].type = AGLAT_Texture;
-	g.shuni[1].value.texture = &g.fbtex;
+	g.shuni[1].value.texture = NULL;
 	g.shuni[1].count = 1;
 
 	g.shuni[2] = (AGLProgramUniform) {
@@ -180,7 +169,9 @@ static void init(void) {
 	g.merge.blend.enable = 0;
 	g.merge.depth.mode = AGLDM_Disabled;
 
-	g.fb.framebuffer = &g.fbo;
+	g.fb.framebuffer = NULL;
+	/* Depth is only needed while rendering into the framebuffer */
+	g.fb.discard_depth = 1;
 }
 
 static void resize(ATimeUs timestamp, unsigned int old_w, unsigned int old_h) {
@@ -191,29 +182,6 @@ static void resize(ATimeUs timestamp, unsigned int old_w, unsigned int old_h) {
 	g.resolution[0] = (float)a_app_state->width;
 	g.resolution[1] = (float)a_app_state->height;
 
-	{
-		const AGLTextureData data = {
-			.type = AGLTT_2D,
-			.format = AGLTF_U8_RGBA,
-			.x = 0,
-			.y = 0,
-			.width = a_app_state->width,
-			.height = a_app_state->height,
-			.pixels = 0,
-		};
-		aGLTextureUpdate(&g.fbtex, &data);
-	}
-
-	aGLFramebufferDestroy(g.fbo);
-	g.fbo = aGLFramebufferCreate((AGLFramebufferCreate){
-		.color = &g.fbtex,
-		.depth = {
-			.enable = 1,
-			.texture = NULL,
-		},
-	});
-	ATTO_ASSERT(g.fbo.name);
-
 	g.screen.viewport.x = 0;
 	g.screen.viewport.y = 0;
 	g.screen.viewport.w = a_app_state->width;
@@ -233,13 +201,32 @@ static void paint(ATimeUs timestamp, float dt) {
 	g.clear.g = sinf(t * .2f);
 	g.clear.b = sinf(t * .3f);
 
+	/* Resizing only changes the key, the pool frees targets of stale sizes a few frames later */
+	g.rt = aGLRenderTargetAcquire((AGLRenderTargetKey){
+		.format = AGLTF_U8_RGBA,
+		.width = a_app_state->width,
+		.height = a_app_state->height,
+		.depth = 1,
+		.samples = 4,
+	});
+	g.fb.framebuffer = &g.rt->framebuffer;
+	g.shuni[1].value.texture = &g.rt->color;
+
 	aGLClear(&g.clear, &g.fb);
 
 	g.uni[0].value.pf = &t;
 	aGLDraw(&g.draw, &g.merge, &g.fb);
 
+	/* Multisampled renderbuffers are not needed once resolved into the color texture;
+	 * implicitly resolved framebuffers have the texture itself attached, so must be kept */
+	aGLFramebufferResolve(&g.rt->framebuffer);
+	if (g.rt->framebuffer.resolve)
+		aGLInvalidate(&g.rt->framebuffer, AGLCB_Color);
+
 	g.shuni[0].value.pf = &t;
 	aGLDraw(&g.show, &g.merge, &g.screen);
+
+	aGLRenderTargetPoolFrame();
 }
 
 static void keyPress(ATimeUs timestamp, AKey key, int pressed) {
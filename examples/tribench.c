@@ -39,6 +39,7 @@ static const char shader_fragment[] =
 	"}";
 
 const unsigned int triangles = 8192 * 2;
+enum { split = 8192 * 3, MaxSplits = 64 };
 
 struct TriVertex {
 	struct AVec3f pos, tricenter, normal, color;
@@ -133,6 +134,7 @@ static void init(void) {
 	g.pun[VUniModel].name = "um4_model";
 	g.pun[VUniModel].type = AGLAT_Mat4;
 	g.pun[VUniModel].count = 1;
+	g.pun[VUniModel].flags = AGLPUF_AlwaysDirty;
 
 	g.pun[VUniLightDir].name = "uv3_lightpos";
 	g.pun[VUniLightDir].type = AGLAT_Vec3;
@@ -149,12 +151,22 @@ static void init(void) {
 	g.draw.attribs.p = g.attr;
 	g.draw.attribs.n = sizeof g.attr / sizeof *g.attr;
 
-	aGLAttributeLocate(g.draw.program, g.attr, g.draw.attribs.n);
+	AGLProgramVariable uniforms[8], attribs[8];
+	AGLProgramReflection reflection = {
+		.uniforms = uniforms,
+		.uniforms_capacity = sizeof uniforms / sizeof *uniforms,
+		.attribs = attribs,
+		.attribs_capacity = sizeof attribs / sizeof *attribs,
+	};
+	const int reflected = aGLProgramReflect(g.draw.program, &reflection);
+	ATTO_ASSERT(reflected);
+
+	aGLAttributeLocateReflected(&reflection, g.attr, g.draw.attribs.n);
 
 	g.draw.uniforms.p = g.pun;
 	g.draw.uniforms.n = sizeof g.pun / sizeof *g.pun;
 
-	aGLUniformLocate(g.draw.program, g.pun, g.draw.uniforms.n);
+	aGLUniformLocateReflected(&reflection, g.pun, g.draw.uniforms.n);
 
 	g.merge.blend.enable = 0;
 	g.merge.depth.mode = AGLDM_TestAndWrite;
@@ -187,6 +199,8 @@ static void paint(ATimeUs timestamp, float dt) {
 	clear.depth = 1;
 	clear.bits = AGLCB_Everything;
 
+	aGLProfileFrame();
+	aGLProfilePassBegin("tribench");
 	aGLClear(&clear, &g.target);
 
 	struct AVec3f lpos = aVec3f(1, 0, 0);
@@ -201,12 +215,21 @@ static void paint(ATimeUs timestamp, float dt) {
 	g.pun[VUniModel].value.pf = &model4.X.x;
 	g.pun[VUniVP].value.pf = &vp4.X.x;
 
-	const unsigned int split = 8192 * 3;
-	for (unsigned int i = 0; i < g.vertices_count / split; ++i) {
-		g.draw.primitive.first = split * i;
-		g.draw.primitive.count = split;
-		aGLDraw(&g.draw, &g.merge, &g.target);
+	/* Ranges are issued MaxSplits at a time */
+	GLint firsts[MaxSplits];
+	GLsizei counts[MaxSplits];
+	GLsizei splits = 0;
+	for (unsigned int first = 0; first < g.vertices_count; first += split) {
+		firsts[splits] = (GLint)first;
+		counts[splits++] = (GLsizei)(g.vertices_count - first < split ? g.vertices_count - first : split);
+		if (splits == MaxSplits) {
+			aGLDrawMulti(&g.draw, &g.merge, &g.target, firsts, counts, splits);
+			splits = 0;
+		}
 	}
+	if (splits)
+		aGLDrawMulti(&g.draw, &g.merge, &g.target, firsts, counts, splits);
+	aGLProfilePassEnd();
 
 	g.pun[VUniModel].value.pf = NULL;
 	g.pun[VUniVP].value.pf = NULL;
@@ -56,7 +56,7 @@
  * - textures
  *   - parameters (min, mag, wraps)
  *   - cubemap
- *   - compressed
+ *   + compressed
  *   - mipmaps
  *   - download
  *   - partial upload
@@ -65,12 +65,12 @@
  *   - copy between buffers/textures
  * - capabilitues
  *   - limits
- *   - features
- *   - extension-based features
+ *   + features
+ *   + extension-based features
  * - optimization
  *   - decrease state changes
  *   - benchmark
- *   - draw-sorting helper
+ *   + draw-sorting helper
  */
 
 #if defined(__cplusplus)
@@ -92,7 +92,18 @@ typedef enum {
 	AGLTF_U5551_RGBA,
 	AGLTF_U4444_RGBA,
 	AGLTF_F32_R,
-	AGLTF_F32_RGBA
+	AGLTF_F32_RGBA,
+	/* Block compressed, see aGLTextureFormatSupported() */
+	AGLTF_ETC1_RGB,
+	AGLTF_ETC2_RGB,
+	AGLTF_ETC2_RGBA,
+	AGLTF_BC1_RGB, /* S3TC DXT1 */
+	AGLTF_BC1_RGBA,
+	AGLTF_BC2_RGBA, /* S3TC DXT3 */
+	AGLTF_BC3_RGBA, /* S3TC DXT5 */
+	AGLTF_BC7_RGBA, /* BPTC */
+	AGLTF_ASTC4x4_RGBA,
+	AGLTF_ASTC8x8_RGBA
 } AGLTextureFormat;
 
 typedef enum {
@@ -130,10 +141,13 @@ typedef struct {
 	AGLTextureMinFilter min_filter;
 	AGLTextureMagFilter mag_filter;
 	AGLTextureWrap wrap_s, wrap_t;
+	AGLTextureWrap wrap_r; /* AGLTT_3D only */
+	GLfloat max_anisotropy; /* see AGLSampler */
 	struct {
 		GLuint name;
 		GLenum min_filter, mag_filter;
-		GLenum wrap_s, wrap_t;
+		GLenum wrap_s, wrap_t, wrap_r;
+		GLfloat max_anisotropy;
 	} _;
 	/* \todo unsigned int sequence__; */
 } AGLTexture;
@@ -153,12 +167,39 @@ typedef struct {
 
 AGLTexture aGLTextureCreate(const AGLTextureData *data);
 void aGLTextureUpdate(AGLTexture *texture, const AGLTextureData *data);
+/* Whether the context can sample textures of this format, compressed formats depend on
+ * a_gl_capabilities.texture_* */
+int aGLTextureFormatSupported(AGLTextureFormat format);
+/* Returns the first supported of formats ordered by preference, AGLTF_Unknown if none is */
+AGLTextureFormat aGLTextureFormatPick(const AGLTextureFormat *formats, int count);
 #define aGLTextureDestroy(t) \
 	do { \
 		glDeleteTextures(1, &(t)->_.name); \
 		(t)->_.name = 0; \
 	} while (0)
 
+/* Sampling parameters that override those of the texture they are used with, so that
+ * one texture can be sampled differently by different draws. Backed by a sampler object
+ * with a_gl_capabilities.sampler_objects, otherwise emulated by setting the texture's own
+ * parameters on bind. Parameters can be changed at any time, they are applied lazily. */
+typedef struct {
+	AGLTextureMinFilter min_filter;
+	AGLTextureMagFilter mag_filter;
+	AGLTextureWrap wrap_s, wrap_t, wrap_r;
+	/* Clamped to a_gl_capabilities.max_anisotropy, 1 disables anisotropic filtering */
+	GLfloat max_anisotropy;
+	struct {
+		GLuint name; /* 0 if emulated */
+		GLenum min_filter, mag_filter;
+		GLenum wrap_s, wrap_t, wrap_r;
+		GLfloat max_anisotropy;
+	} _;
+} AGLSampler;
+
+/* Linear filtering without mipmaps, repeat wrapping and no anisotropy */
+AGLSampler aGLSamplerCreate(void);
+void aGLSamplerDestroy(AGLSampler *sampler);
+
 /* Shader programs */
 
 /* FIXME rename */
@@ -177,6 +218,11 @@ typedef enum {
 	AGLAT_Texture
 } AGLAttributeType;
 
+enum AGLProgramUniformFlags {
+	// Skip shadow value comparison and always upload, for values that change on every draw
+	AGLPUF_AlwaysDirty = (1 << 0),
+};
+
 typedef struct {
 	const char *name;
 	AGLAttributeType type;
@@ -186,6 +232,10 @@ typedef struct {
 		const GLint *pi;
 		const AGLTexture *texture;
 	} value;
+	uint32_t flags; // Combination of AGLProgramUniformFlags
+	uint32_t id; /* aGLNameHash(name), filled by aGLUniformLocateReflected() if 0 */
+	/* AGLAT_Texture only, NULL samples with the texture's own parameters */
+	const AGLSampler *sampler;
 	struct {
 		GLint location;
 	} _;
@@ -197,22 +247,146 @@ AGLProgram aGLProgramCreate(const char *const *vertex, const char *const *fragme
 AGLProgram aGLProgramCreateSimple(const char *vertex, const char *fragment);
 #define aGLProgramDestroy(p) \
 	do { glDeleteProgram(p); } while (0)
+
+/* Compiles and links a program without waiting for the result. aGLProgramPoll() returns 0
+ * while it is still being built, 1 once program is ready, or the same negative error as
+ * aGLProgramCreate() with the log in a_gl_error.
+ * Polling never blocks only with a_gl_capabilities.parallel_shader_compile, otherwise the
+ * first poll waits for the driver. Create all programs before polling any of them so that
+ * their compiles can overlap. */
+typedef struct {
+	AGLProgram program; /* 0 while pending */
+	struct {
+		GLuint program, vertex, fragment;
+		int cache;
+		uint64_t cache_key;
+	} _;
+} AGLProgramAsync;
+
+AGLProgramAsync aGLProgramCreateAsync(const char *const *vertex, const char *const *fragment);
+int aGLProgramPoll(AGLProgramAsync *program);
+
+/* Linked programs are stored in and loaded from this directory, NULL (default) disables.
+ * Files are keyed by a hash of the shader sources and GL_RENDERER/GL_VERSION, stale or
+ * rejected binaries are recompiled and overwritten. The string must stay valid.
+ * Requires a_gl_capabilities.program_binary, does nothing otherwise. */
+void aGLProgramCacheSet(const char *directory);
 void aGLUniformLocate(AGLProgram program, AGLProgramUniform *uniforms, int count);
 
 /* Array buffers */
 
-typedef enum { AGLBT_Vertex = GL_ARRAY_BUFFER, AGLBT_Index = GL_ELEMENT_ARRAY_BUFFER } AGLBufferType;
+typedef enum {
+	AGLBT_Vertex = GL_ARRAY_BUFFER,
+	AGLBT_Index = GL_ELEMENT_ARRAY_BUFFER,
+#ifdef GL_UNIFORM_BUFFER
+	AGLBT_Uniform = GL_UNIFORM_BUFFER,
+#endif
+#ifdef GL_DRAW_INDIRECT_BUFFER
+	AGLBT_DrawIndirect = GL_DRAW_INDIRECT_BUFFER,
+#endif
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	AGLBT_PixelUnpack = GL_PIXEL_UNPACK_BUFFER,
+	AGLBT_PixelPack = GL_PIXEL_PACK_BUFFER,
+#endif
+} AGLBufferType;
+
+typedef enum {
+	AGLBU_Static = GL_STATIC_DRAW, /* default */
+	AGLBU_Dynamic = GL_DYNAMIC_DRAW,
+	AGLBU_Stream = GL_STREAM_DRAW,
+#ifdef GL_STREAM_READ
+	AGLBU_StreamRead = GL_STREAM_READ, /* written by GL, read back once */
+#endif
+} AGLBufferUsage;
 
 typedef struct {
 	GLuint name;
 	AGLBufferType type;
+	AGLBufferUsage usage; /* used for the next allocation */
+	GLsizei size; /* allocated size */
 } AGLBuffer;
 
 AGLBuffer aGLBufferCreate(AGLBufferType type);
+/* Replaces the entire buffer contents, reallocating it */
 void aGLBufferUpload(AGLBuffer *buffer, GLsizei size, const void *data);
+/* Updates a range in place, reallocating only if it doesn't fit. Growing at a non-zero offset
+ * at least doubles the size and keeps the existing contents with a_gl_capabilities.copy_buffer,
+ * without it they are lost and the rest of the buffer is undefined */
+void aGLBufferUpdate(AGLBuffer *buffer, GLsizei offset, GLsizei size, const void *data);
 #define aGLBufferDestroy(b) \
 	do { glDeleteBuffers(1, &(b)->name); (b)->name = 0; } while (0)
 
+/* Streaming buffer for per-frame dynamic geometry. Ranges are appended to one large buffer
+ * until it is full, then its storage is orphaned and allocation restarts from the beginning,
+ * so ranges the GPU might still be reading are never overwritten. Size it to hold at least
+ * a frame worth of data.
+ * Returned offsets can be used directly as AGLAttribute.ptr and primitive.index.data.offset
+ * with stream.buffer as the attribute or index buffer. */
+typedef struct {
+	AGLBuffer buffer;
+	struct {
+		GLsizei offset;
+	} _;
+} AGLStreamBuffer;
+
+AGLStreamBuffer aGLStreamBufferCreate(AGLBufferType type, GLsizei size);
+/* Copies size bytes of data into the next range aligned to alignment bytes, returns its offset */
+GLintptr aGLStreamBufferPush(AGLStreamBuffer *stream, const void *data, GLsizei size, GLsizei alignment);
+/* Same as aGLStreamBufferPush(), but maps the range so that the caller can write into it
+ * directly. Returns NULL without a_gl_capabilities.map_buffer_range. The range must be
+ * unmapped before the buffer is used by GL */
+void *aGLStreamBufferMap(AGLStreamBuffer *stream, GLsizei size, GLsizei alignment, GLintptr *offset);
+void aGLStreamBufferUnmap(AGLStreamBuffer *stream);
+#define aGLStreamBufferDestroy(s) aGLBufferDestroy(&(s)->buffer)
+
+/* Texture uploads through pixel unpack buffers, available with a_gl_capabilities.pixel_buffer
+ * (GL 2.1, GL_ARB_pixel_buffer_object or GLES 3). The driver then doesn't have to copy pixels
+ * synchronously, and with an AGLBT_PixelUnpack stream buffer uploads don't wait for the GPU */
+
+/* Size of pixel data for a texture update, rows but the last one are padded to 4 bytes as
+ * GL_UNPACK_ALIGNMENT expects */
+GLsizei aGLTextureDataSize(const AGLTextureData *data);
+/* data->pixels is a byte offset into buffer, which must be AGLBT_PixelUnpack */
+void aGLTextureUpdateFromBuffer(AGLTexture *texture, const AGLTextureData *data, const AGLBuffer *buffer);
+/* Copies data->pixels into the stream buffer and updates texture from there. Without pixel
+ * buffer support it is the same as aGLTextureUpdate() */
+void aGLTextureUpdateStream(AGLTexture *texture, const AGLTextureData *data, AGLStreamBuffer *stream);
+
+/* Uniform blocks, available with a_gl_capabilities.uniform_buffer */
+
+typedef struct {
+	const char *name;
+	GLuint binding; /* binding point the block is assigned to */
+	struct {
+		GLuint index;
+	} _;
+} AGLUniformBlock;
+
+/* Finds blocks in program and assigns them to their binding points */
+void aGLUniformBlockLocate(AGLProgram program, AGLUniformBlock *blocks, int count);
+void aGLUniformBufferBind(GLuint binding, const AGLBuffer *buffer, GLintptr offset, GLsizei size);
+/* Uploads data to the next properly aligned range of an AGLBT_Uniform stream buffer and binds
+ * it, e.g. once per frame for data shared by all draws */
+GLintptr aGLUniformBlockPush(AGLStreamBuffer *stream, GLuint binding, const void *data, GLsizei size);
+
+/* std140 layout writer. Each value is aligned according to std140 rules, stored, and its offset
+ * is returned. Vectors and matrices are passed as pointers to floats, e.g. &mat.X.x for AMat4f */
+typedef struct {
+	void *data;
+	GLsizei size; /* capacity of data */
+	GLsizei offset; /* bytes written so far */
+} AGLStd140Writer;
+
+GLsizei aGLStd140Float(AGLStd140Writer *writer, GLfloat value);
+GLsizei aGLStd140Int(AGLStd140Writer *writer, GLint value);
+GLsizei aGLStd140Vec2(AGLStd140Writer *writer, const GLfloat *value);
+GLsizei aGLStd140Vec3(AGLStd140Writer *writer, const GLfloat *value);
+GLsizei aGLStd140Vec4(AGLStd140Writer *writer, const GLfloat *value);
+GLsizei aGLStd140Mat3(AGLStd140Writer *writer, const GLfloat *value);
+GLsizei aGLStd140Mat4(AGLStd140Writer *writer, const GLfloat *value);
+/* Pads the block to a vec4 boundary and returns its size */
+GLsizei aGLStd140End(AGLStd140Writer *writer);
+
 /* Draw */
 
 typedef struct {
@@ -223,6 +397,8 @@ typedef struct {
 	GLboolean normalized;
 	GLsizei stride;
 	const GLvoid *ptr;
+	GLuint divisor; /* 0 = per vertex, N = advance once per N instances */
+	uint32_t id; /* aGLNameHash(name), filled by aGLAttributeLocateReflected() if 0 */
 	struct {
 		GLint location;
 	} _;
@@ -230,6 +406,49 @@ typedef struct {
 
 void aGLAttributeLocate(AGLProgram program, AGLAttribute *attribs, int count);
 
+/* Program reflection
+ * aGLProgramReflect() enumerates active uniforms and attributes of a linked program once
+ * into tables sorted by name hash. Uniform and attribute sets can then be located by id
+ * without string lookups, and can be shared between program variants by locating them again
+ * for each. Arrays are listed by their name without "[0]", uniform block members are not
+ * listed. Uniforms with mismatching type or array size are reported and left unlocated.
+ * Storage is provided by the user, reflection fails if it is too small. */
+typedef struct {
+	uint32_t hash;
+	GLint location;
+	GLenum type; /* GL_FLOAT_VEC3, GL_SAMPLER_2D, ... */
+	GLint size; /* array length */
+} AGLProgramVariable;
+
+typedef struct {
+	AGLProgramVariable *uniforms;
+	unsigned uniforms_capacity, nuniforms;
+	AGLProgramVariable *attribs;
+	unsigned attribs_capacity, nattribs;
+} AGLProgramReflection;
+
+uint32_t aGLNameHash(const char *name);
+/* Returns 0 if storage is too small */
+int aGLProgramReflect(AGLProgram program, AGLProgramReflection *reflection);
+void aGLUniformLocateReflected(const AGLProgramReflection *reflection, AGLProgramUniform *uniforms, int count);
+void aGLAttributeLocateReflected(const AGLProgramReflection *reflection, AGLAttribute *attribs, int count);
+
+/* Attribute set and index buffer baked into a vertex array object, so that binding them for
+ * a draw is a single call. Attributes must be located beforehand and must not change
+ * afterwards. Without vertex array objects, or with client-side attribute arrays, attributes
+ * are bound one by one on each draw instead. */
+typedef struct {
+	const AGLAttribute *attribs;
+	unsigned nattribs;
+	const AGLBuffer *index_buffer;
+	struct {
+		GLuint name; /* 0 if not baked */
+	} _;
+} AGLVertexLayout;
+
+AGLVertexLayout aGLVertexLayoutCreate(const AGLAttribute *attribs, unsigned nattribs, const AGLBuffer *index_buffer);
+void aGLVertexLayoutDestroy(AGLVertexLayout *layout);
+
 typedef enum {
 	AGLCM_Disable = 0,
 	AGLCM_Front = GL_FRONT,
@@ -267,7 +486,12 @@ typedef struct {
 		} index;
 		AGLCullMode cull_mode;
 		AGLFrontFace front_face;
+		/* Number of instances, 0 is the same as 1. Without instancing support each instance is
+		 * a separate draw, and per-instance attributes must be GL_FLOAT client-side arrays */
+		GLsizei instances;
 	} primitive;
+	/* Optional, if set overrides attribs and primitive.index.buffer */
+	const AGLVertexLayout *layout;
 } AGLDrawSource;
 
 typedef enum {
@@ -334,31 +558,200 @@ typedef struct {
 	AGLDepthParams depth;
 } AGLDrawMerge;
 
+#ifndef ATTO_GL_MAX_COLOR_ATTACHMENTS
+	#define ATTO_GL_MAX_COLOR_ATTACHMENTS 8
+#endif
+
+/* color[] is attached to GL_COLOR_ATTACHMENT0 and up until the first NULL, and fragment
+ * outputs 0..n-1 are routed to them with glDrawBuffers(). More than one color attachment
+ * requires a_gl_capabilities.max_draw_buffers of at least as many. All attachments must
+ * have the same size.
+ * samples > 1 requests multisampling, clamped to a_gl_capabilities.max_samples, and
+ * falls back to single sample without it. With multisampled_render_to_texture the color
+ * textures are rendered to directly and resolved implicitly, otherwise drawing goes to
+ * multisampled renderbuffers that aGLFramebufferResolve() blits into the textures.
+ * Multisampled depth can only be a renderbuffer, depth.texture must be NULL. */
 typedef struct {
-	const AGLTexture *color;
+	const AGLTexture *color[ATTO_GL_MAX_COLOR_ATTACHMENTS];
 	struct {
 		int enable;
 		AGLTexture *texture;
 	} depth;
+	GLsizei samples;
 } AGLFramebufferCreate;
 
 typedef struct {
 	GLuint name;
 	GLuint depth_renderbuffer;
+	int colors;
+	GLsizei width, height;
+	GLsizei samples; /* 0 if single sampled */
+	/* Multisampled renderbuffers and the texture-backed framebuffer they resolve into,
+	 * 0 for single sample and implicitly resolved framebuffers */
+	GLuint color_renderbuffers[ATTO_GL_MAX_COLOR_ATTACHMENTS];
+	GLuint resolve;
 } AGLFramebuffer;
 
 AGLFramebuffer aGLFramebufferCreate(AGLFramebufferCreate params);
 void aGLFramebufferDestroy(AGLFramebuffer);
 
+/* Blits multisampled color attachments into the textures they were created with.
+ * Does nothing for single sample and implicitly resolved framebuffers. Multisampled
+ * contents are kept, aGLInvalidate() them afterwards if they are no longer needed. */
+void aGLFramebufferResolve(const AGLFramebuffer *fbo);
+
+/* Pool of transient render targets, a color texture with its framebuffer each.
+ * aGLRenderTargetAcquire() hands out a target matching key that hasn't been acquired since
+ * the last aGLRenderTargetPoolFrame(), creating one if there is none, in an empty slot or in
+ * place of the least recently used idle target. Returns NULL when all
+ * ATTO_GL_RENDER_TARGET_POOL_SIZE targets are already acquired this frame. Contents of an
+ * acquired target are undefined and it stays valid until the next aGLRenderTargetPoolFrame(),
+ * called once per frame, which also frees targets unused for ATTO_GL_RENDER_TARGET_POOL_FRAMES
+ * frames. */
+typedef struct {
+	AGLTextureFormat format;
+	GLsizei width, height;
+	int depth;
+	GLsizei samples;
+} AGLRenderTargetKey;
+
+typedef struct {
+	AGLRenderTargetKey key;
+	AGLTexture color;
+	AGLFramebuffer framebuffer;
+	struct {
+		unsigned last_used;
+		int acquired;
+	} _;
+} AGLRenderTarget;
+
+AGLRenderTarget *aGLRenderTargetAcquire(AGLRenderTargetKey key);
+void aGLRenderTargetPoolFrame(void);
+/* Frees all pooled targets, acquired ones included */
+void aGLRenderTargetPoolClear(void);
+
+/* Atlas packing many small images into the layers of one AGLTT_2DArray texture, so that
+ * they can all be drawn with a single texture binding. Fill in the parameters and storage
+ * of a zeroed AGLAtlas, the texture is created by the first aGLAtlasAdd(). Images are placed
+ * on shelves, rows as tall as the first image put on them. When nothing fits the layer count
+ * is doubled up to max_layers, existing layers are copied through a framebuffer, so format
+ * must be uncompressed and color-renderable. */
+typedef struct {
+	unsigned layer, x, y, width, height;
+	/* Texture coordinates of the image edges */
+	GLfloat u0, v0, u1, v1;
+	struct {
+		int state;
+		unsigned next_free;
+	} _;
+} AGLAtlasRegion;
+
+typedef struct {
+	unsigned layer, y, height;
+	unsigned used, live;
+} AGLAtlasShelf;
+
+typedef struct {
+	AGLTextureFormat format;
+	GLsizei width, height; /* of a layer */
+	GLsizei max_layers;
+	/* Texels around each image filled with copies of its edges, so that linear filtering at
+	 * the image edges doesn't sample neighbours or stale contents */
+	unsigned padding;
+	AGLAtlasShelf *shelves;
+	unsigned shelves_capacity;
+	/* Images and the space freed by removed ones */
+	AGLAtlasRegion *regions;
+	unsigned regions_capacity;
+	AGLTexture texture;
+	struct {
+		GLsizei layers;
+		unsigned shelves, regions;
+		unsigned free_regions;
+	} _;
+} AGLAtlas;
+
+/* Returns a handle to the image, 0 if it doesn't fit or regions are exhausted. pixels are
+ * laid out as for aGLTextureUpdate(), NULL leaves the image and its padding undefined */
+unsigned aGLAtlasAdd(AGLAtlas *atlas, unsigned width, unsigned height, const void *pixels);
+/* Replaces the contents of the image, padding included. pixels must not be NULL */
+void aGLAtlasUpdate(AGLAtlas *atlas, unsigned handle, const void *pixels);
+/* Where the image is, unaffected by growing. Valid until the image is removed */
+const AGLAtlasRegion *aGLAtlasGet(const AGLAtlas *atlas, unsigned handle);
+/* Evicts the image, its space is reused by later images of similar height */
+void aGLAtlasRemove(AGLAtlas *atlas, unsigned handle);
+/* Removes all images but keeps the texture */
+void aGLAtlasClear(AGLAtlas *atlas);
+void aGLAtlasDestroy(AGLAtlas *atlas);
+
 typedef struct {
 	struct {
 		unsigned x, y, w, h;
 	} viewport;
 	const AGLFramebuffer *framebuffer;
+	/* Invalidate depth once drawing moves on to another framebuffer, see aGLInvalidate() */
+	int discard_depth;
 } AGLDrawTarget;
 
 void aGLDraw(const AGLDrawSource *source, const AGLDrawMerge *merge, const AGLDrawTarget *target);
 
+/* Draws n ranges of the same source with state bound only once. firsts[] are first vertices,
+ * or for indexed sources first indices counted from primitive.index.data, primitive.first and
+ * primitive.count are ignored. Uses glMultiDraw* if a_gl_capabilities.multi_draw allows,
+ * otherwise draws ranges one by one. Executes any recorded command buffer draws first. */
+void aGLDrawMulti(const AGLDrawSource *source, const AGLDrawMerge *merge, const AGLDrawTarget *target,
+	const GLint *firsts, const GLsizei *counts, GLsizei n);
+
+/* Layouts of commands in an AGLBT_DrawIndirect buffer */
+typedef struct {
+	GLuint count, instances, first, base_instance;
+} AGLDrawArraysIndirect;
+
+typedef struct {
+	GLuint count, instances, first; /* first index */
+	GLint base_vertex;
+	GLuint base_instance;
+} AGLDrawElementsIndirect;
+
+/* Draws n tightly packed AGLDrawArraysIndirect commands, or AGLDrawElementsIndirect for
+ * indexed sources, read from the buffer at offset. primitive.index.data is ignored.
+ * Requires a_gl_capabilities.multi_draw_indirect (GL 4.3 or GL_ARB_multi_draw_indirect). */
+void aGLDrawMultiIndirect(const AGLDrawSource *source, const AGLDrawMerge *merge, const AGLDrawTarget *target,
+	const AGLBuffer *commands, GLintptr offset, GLsizei n);
+
+/* Deferred draw command buffer
+ * While a command buffer is active aGLDraw() only records draws. aGLCommandBufferSubmit()
+ * sorts them by state to minimize state changes, merges adjacent draws with identical state
+ * and contiguous ranges, and then executes them.
+ * Draws are only reordered within a run of draws into the same target. Only draws without
+ * blending that test and write depth with AGLDF_Less or AGLDF_Greater are order-independent,
+ * all others are never moved across differing state.
+ * aGLClear() executes everything recorded so far before clearing.
+ * Uniform descriptors are copied on record, but everything they and the attributes point to
+ * (values, textures, buffers, client arrays) must stay valid and unchanged until submit.
+ * Storage is provided by the user. When it is exhausted, recorded draws are executed early. */
+typedef struct {
+	AGLDrawSource source;
+	AGLDrawMerge merge;
+	AGLDrawTarget target;
+	uint64_t key;
+	unsigned sequence;
+} AGLDrawCommand;
+
+typedef struct {
+	AGLDrawCommand *commands;
+	unsigned commands_capacity;
+	AGLProgramUniform *uniforms;
+	unsigned uniforms_capacity;
+	struct {
+		unsigned commands, uniforms;
+		unsigned segment;
+	} _;
+} AGLCommandBuffer;
+
+void aGLCommandBufferBegin(AGLCommandBuffer *buffer);
+void aGLCommandBufferSubmit(AGLCommandBuffer *buffer);
+
 typedef enum {
 	AGLCB_Color = GL_COLOR_BUFFER_BIT,
 	AGLCB_Depth = GL_DEPTH_BUFFER_BIT,
@@ -372,17 +765,119 @@ typedef struct {
 } AGLClearParams;
 
 void aGLClear(const AGLClearParams *params, const AGLDrawTarget *target);
-#if 0
-// TODO: need to check whether it's available: gl4, gles3, or GL_ARB_invalidate_subdata
-// For that, need to have _features_, either at compile time "I NEED THIS, FAIL WITHOUT", or at runtime -- cheap bools.
-void aGLInvalidate(const AGLFramebuffer *fbo);
+
+/* Asynchronous readback of RGBA8 pixels from a framebuffer, NULL for the default one.
+ * aGLReadbackBegin() issues glReadPixels into the next pixel pack buffer of a ring and
+ * fences it, returns 0 if all ATTO_GL_READBACK_SLOTS are still in flight. aGLReadbackPoll()
+ * returns pixels of the oldest readback once its fence has signalled, or NULL, in the order
+ * they were begun. Returned pixels stay valid until the next poll.
+ * Without a_gl_capabilities.pixel_buffer, sync and map_buffer_range pixels are read
+ * synchronously on begin. Zero-initialize before use. */
+#ifndef ATTO_GL_READBACK_SLOTS
+	#define ATTO_GL_READBACK_SLOTS 3
 #endif
 
-/* \todo
 typedef struct {
-	const char *a_gl_extensions;
+	struct {
+		AGLBuffer buffer;
+		void *fence; /* GLsync */
+		void *pixels; /* synchronous fallback storage */
+		GLsizei capacity;
+		unsigned width, height;
+	} slots[ATTO_GL_READBACK_SLOTS];
+	struct {
+		unsigned first, count;
+		int polled; /* first slot was returned by the last poll */
+	} _;
+} AGLReadback;
+
+int aGLReadbackBegin(AGLReadback *readback, const AGLFramebuffer *framebuffer, unsigned x, unsigned y,
+	unsigned width, unsigned height);
+const void *aGLReadbackPoll(AGLReadback *readback, unsigned *width, unsigned *height);
+void aGLReadbackDestroy(AGLReadback *readback);
+
+/* Tells the driver that color and/or depth contents of a framebuffer, NULL for the default one,
+ * are no longer needed, so tile-based GPUs can skip storing them to memory. Uses
+ * glInvalidateFramebuffer() with a_gl_capabilities.invalidate_framebuffer, or
+ * glDiscardFramebufferEXT() with a_gl_capabilities.discard_framebuffer, does nothing otherwise.
+ * Targets with discard_depth set get their depth invalidated automatically when a draw or
+ * clear binds another framebuffer; the default framebuffer is never left that way, so call
+ * this before swapping instead. */
+void aGLInvalidate(const AGLFramebuffer *fbo, AGLClearBits bits);
+
+/* Counters accumulated since the last aGLStatsReset(), normally reset once per frame.
+ * Binds and state changes count actual GL calls, i.e. those not skipped by the state cache */
+typedef struct {
+	unsigned int draws; /* ranges drawn, each multi-draw range and emulated instance counts */
+	unsigned int draw_calls; /* GL draw calls */
+	unsigned int vertices;
+	unsigned int primitives;
+	unsigned int program_binds;
+	unsigned int texture_binds;
+	unsigned int sampler_binds;
+	unsigned int buffer_binds;
+	unsigned int vertex_array_binds;
+	unsigned int framebuffer_binds;
+	unsigned int uniform_uploads;
+	unsigned int uniform_uploads_skipped;
+	unsigned int blend_changes;
+	unsigned int depth_changes;
+	unsigned int cull_changes;
+	uint64_t bytes_uploaded; /* buffer and texture data */
+} AGLStats;
+
+AGLStats aGLStatsGet(void);
+void aGLStatsReset(void);
+
+/* GPU pass timing
+ * Opt-in by defining ATTO_GL_PROFILE_GPU_FUNC(name, microseconds) for the implementation,
+ * otherwise these do nothing. Passes are measured with GL_TIME_ELAPSED queries from a ring
+ * of ATTO_GL_GPU_TIMER_FRAMES frames, and reported by aGLProfileFrame() that many frames
+ * later so that reading results never stalls. Results that are still not ready by then are
+ * dropped. Passes can't nest, names must stay valid until reported.
+ * Requires a_gl_capabilities.timer_query (GL 3.3 or GL_ARB_timer_query). */
+void aGLProfilePassBegin(const char *name);
+void aGLProfilePassEnd(void);
+/* Call once per frame, reports finished passes */
+void aGLProfileFrame(void);
+
+/* Runtime capabilities of the current context, detected by aGLInit().
+ * Features can be turned off after aGLInit() to force fallback paths. */
+typedef struct {
+	int version_major, version_minor;
+	int es;
+	int vertex_array_object;
+	int instancing;
+	int map_buffer_range;
+	int copy_buffer;
+	int uniform_buffer;
+	GLint uniform_buffer_offset_alignment;
+	int multi_draw;
+	int multi_draw_indirect;
+	int timer_query;
+	int program_binary;
+	int parallel_shader_compile;
+	int pixel_buffer;
+	int sync;
+	int invalidate_framebuffer;
+	/* GL_EXT_discard_framebuffer on GLES2 */
+	int discard_framebuffer;
+	/* Largest aGLFramebufferCreate() sample count, 0 without multisampled framebuffers */
+	GLint max_samples;
+	/* GL_EXT_multisampled_render_to_texture */
+	int multisampled_render_to_texture;
+	int sampler_objects;
+	/* Largest texture anisotropy, 1 without anisotropic filtering */
+	GLfloat max_anisotropy;
+	/* Color attachments usable at once by aGLFramebufferCreate(), 1 without glDrawBuffers() */
+	GLint max_draw_buffers;
+	/* Compressed texture formats */
+	int texture_etc1, texture_etc2, texture_s3tc, texture_bptc, texture_astc;
+	/* BC1 only, GL_EXT_texture_compression_dxt1 on GLES, also set with texture_s3tc */
+	int texture_dxt1;
 } AGLCapabilities;
-*/
+
+extern AGLCapabilities a_gl_capabilities;
 
 extern char a_gl_error[];
 
@@ -403,11 +898,20 @@ extern char a_gl_error[];
 		X(PFNGLBLENDEQUATIONSEPARATEPROC, glBlendEquationSeparate) \
 		X(PFNGLBLENDFUNCSEPARATEPROC, glBlendFuncSeparate) \
 		X(PFNGLBUFFERDATAPROC, glBufferData) \
+		X(PFNGLBUFFERSUBDATAPROC, glBufferSubData) \
 		X(PFNGLCHECKFRAMEBUFFERSTATUSPROC, glCheckFramebufferStatus) \
 		X(PFNGLCLEARDEPTHFPROC, glClearDepthf) \
 		X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+		X(PFNGLCOMPRESSEDTEXIMAGE1DPROC, glCompressedTexImage1D) \
+		X(PFNGLCOMPRESSEDTEXIMAGE2DPROC, glCompressedTexImage2D) \
+		X(PFNGLCOMPRESSEDTEXIMAGE3DPROC, glCompressedTexImage3D) \
+		X(PFNGLCOMPRESSEDTEXSUBIMAGE1DPROC, glCompressedTexSubImage1D) \
+		X(PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC, glCompressedTexSubImage2D) \
+		X(PFNGLCOMPRESSEDTEXSUBIMAGE3DPROC, glCompressedTexSubImage3D) \
+		X(PFNGLCOPYTEXSUBIMAGE3DPROC, glCopyTexSubImage3D) \
 		X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
 		X(PFNGLCREATESHADERPROC, glCreateShader) \
+		X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
 		X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
 		X(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
 		X(PFNGLDELETERENDERBUFFERSPROC, glDeleteRenderbuffers) \
@@ -421,6 +925,8 @@ extern char a_gl_error[];
 		X(PFNGLGENERATEMIPMAPPROC, glGenerateMipmap) \
 		X(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers) \
 		X(PFNGLGENRENDERBUFFERSPROC, glGenRenderbuffers) \
+		X(PFNGLGETACTIVEATTRIBPROC, glGetActiveAttrib) \
+		X(PFNGLGETACTIVEUNIFORMPROC, glGetActiveUniform) \
 		X(PFNGLGETATTRIBLOCATIONPROC, glGetAttribLocation) \
 		X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
 		X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
@@ -449,10 +955,56 @@ extern char a_gl_error[];
 		X(PFNGLUNIFORMMATRIX3FVPROC, glUniformMatrix3fv) \
 		X(PFNGLUNIFORMMATRIX4FVPROC, glUniformMatrix4fv) \
 		X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+		X(PFNGLVERTEXATTRIB1FVPROC, glVertexAttrib1fv) \
+		X(PFNGLVERTEXATTRIB2FVPROC, glVertexAttrib2fv) \
+		X(PFNGLVERTEXATTRIB3FVPROC, glVertexAttrib3fv) \
+		X(PFNGLVERTEXATTRIB4FVPROC, glVertexAttrib4fv) \
 		X(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer) \
 
+	/* Not required to be present, only used if a_gl_capabilities says so */
+	#define ATTO__GL_FUNCS_LIST_OPTIONAL(X) \
+		X(PFNGLBEGINQUERYPROC, glBeginQuery) \
+		X(PFNGLBINDBUFFERRANGEPROC, glBindBufferRange) \
+		X(PFNGLBINDSAMPLERPROC, glBindSampler) \
+		X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray) \
+		X(PFNGLBLITFRAMEBUFFERPROC, glBlitFramebuffer) \
+		X(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync) \
+		X(PFNGLCOPYBUFFERSUBDATAPROC, glCopyBufferSubData) \
+		X(PFNGLDELETEQUERIESPROC, glDeleteQueries) \
+		X(PFNGLDELETESAMPLERSPROC, glDeleteSamplers) \
+		X(PFNGLDELETESYNCPROC, glDeleteSync) \
+		X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays) \
+		X(PFNGLDRAWARRAYSINSTANCEDPROC, glDrawArraysInstanced) \
+		X(PFNGLDRAWELEMENTSINSTANCEDPROC, glDrawElementsInstanced) \
+		X(PFNGLENDQUERYPROC, glEndQuery) \
+		X(PFNGLFENCESYNCPROC, glFenceSync) \
+		X(PFNGLFRAMEBUFFERTEXTURELAYERPROC, glFramebufferTextureLayer) \
+		X(PFNGLGENQUERIESPROC, glGenQueries) \
+		X(PFNGLGENSAMPLERSPROC, glGenSamplers) \
+		X(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays) \
+		X(PFNGLGETPROGRAMBINARYPROC, glGetProgramBinary) \
+		X(PFNGLGETQUERYOBJECTIVPROC, glGetQueryObjectiv) \
+		X(PFNGLGETQUERYOBJECTUI64VPROC, glGetQueryObjectui64v) \
+		X(PFNGLGETSTRINGIPROC, glGetStringi) \
+		X(PFNGLGETUNIFORMBLOCKINDEXPROC, glGetUniformBlockIndex) \
+		X(PFNGLINVALIDATEFRAMEBUFFERPROC, glInvalidateFramebuffer) \
+		X(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange) \
+		X(PFNGLMULTIDRAWARRAYSPROC, glMultiDrawArrays) \
+		X(PFNGLMULTIDRAWARRAYSINDIRECTPROC, glMultiDrawArraysIndirect) \
+		X(PFNGLMULTIDRAWELEMENTSPROC, glMultiDrawElements) \
+		X(PFNGLMULTIDRAWELEMENTSINDIRECTPROC, glMultiDrawElementsIndirect) \
+		X(PFNGLPROGRAMBINARYPROC, glProgramBinary) \
+		X(PFNGLPROGRAMPARAMETERIPROC, glProgramParameteri) \
+		X(PFNGLRENDERBUFFERSTORAGEMULTISAMPLEPROC, glRenderbufferStorageMultisample) \
+		X(PFNGLSAMPLERPARAMETERFPROC, glSamplerParameterf) \
+		X(PFNGLSAMPLERPARAMETERIPROC, glSamplerParameteri) \
+		X(PFNGLUNIFORMBLOCKBINDINGPROC, glUniformBlockBinding) \
+		X(PFNGLUNMAPBUFFERPROC, glUnmapBuffer) \
+		X(PFNGLVERTEXATTRIBDIVISORPROC, glVertexAttribDivisor) \
+
 #define ATTO__DECLARE_FUNC_EXTERN(T_, N_) extern T_ N_;
 ATTO__GL_FUNCS_LIST(ATTO__DECLARE_FUNC_EXTERN)
+ATTO__GL_FUNCS_LIST_OPTIONAL(ATTO__DECLARE_FUNC_EXTERN)
 #undef ATTO__DECLARE_FUNC_EXTERN
 #endif /* ifdef ATTO_PLATFORM_WINDOWS */
 
@@ -468,6 +1020,10 @@ ATTO__GL_FUNCS_LIST(ATTO__DECLARE_FUNC_EXTERN)
 #endif /* ifdef ATTO__GL_H_IMPLEMENTED */
 #define ATTO__GL_H_IMPLEMENTED
 
+#include <stdio.h> /* program cache files */
+#include <stdlib.h> /* qsort() */
+#include <string.h> /* memcpy() */
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -551,11 +1107,61 @@ char a_gl_error[ATTO_GL_ERROR_BUFFER_SIZE];
 	#define ATTO_GL_MAX_ATTRIBS 8
 #endif
 
-typedef struct {
-	unsigned int vertices;
-	unsigned int triangles;
-	unsigned int draw_calls;
-} AGLStats;
+#ifndef ATTO_GL_MAX_TEXTURE_UNITS
+	#define ATTO_GL_MAX_TEXTURE_UNITS 16
+#endif
+
+#ifndef ATTO_GL_MAX_UNIFORM_BUFFER_BINDINGS
+	#define ATTO_GL_MAX_UNIFORM_BUFFER_BINDINGS 16
+#endif
+
+/* Render targets pooled at once, and frames a target may stay unused before it is freed */
+#ifndef ATTO_GL_RENDER_TARGET_POOL_SIZE
+	#define ATTO_GL_RENDER_TARGET_POOL_SIZE 16
+#endif
+#ifndef ATTO_GL_RENDER_TARGET_POOL_FRAMES
+	#define ATTO_GL_RENDER_TARGET_POOL_FRAMES 3
+#endif
+
+/* Frames in flight for GPU timer queries and passes measured per frame */
+#ifndef ATTO_GL_GPU_TIMER_FRAMES
+	#define ATTO_GL_GPU_TIMER_FRAMES 4
+#endif
+#ifndef ATTO_GL_GPU_TIMER_PASSES
+	#define ATTO_GL_GPU_TIMER_PASSES 16
+#endif
+
+/* Longer active uniform and attribute names are not reflected */
+#ifndef ATTO_GL_REFLECTION_NAME_SIZE
+	#define ATTO_GL_REFLECTION_NAME_SIZE 256
+#endif
+
+#ifndef ATTO_GL_PROGRAM_CACHE_PATH_SIZE
+	#define ATTO_GL_PROGRAM_CACHE_PATH_SIZE 512
+#endif
+
+/* Number of index offsets passed to a single glMultiDrawElements call */
+#ifndef ATTO_GL_MULTI_DRAW_BATCH
+	#define ATTO_GL_MULTI_DRAW_BATCH 64
+#endif
+
+/* Number of (program, uniform location) values remembered to skip redundant uploads */
+#ifndef ATTO_GL_UNIFORM_CACHE_SIZE
+	#define ATTO_GL_UNIFORM_CACHE_SIZE 256
+#endif
+
+/* Larger uniform values (arrays) are always uploaded. Default fits one mat4 */
+#ifndef ATTO_GL_UNIFORM_CACHE_VALUE_SIZE
+	#define ATTO_GL_UNIFORM_CACHE_VALUE_SIZE 64
+#endif
+
+/* Last value uploaded to a program uniform. Direct-mapped by program and location */
+struct A__GLUniformShadow {
+	AGLProgram program; /* 0 for empty */
+	GLint location;
+	size_t size;
+	unsigned char value[ATTO_GL_UNIFORM_CACHE_VALUE_SIZE];
+};
 
 static struct {
 	AGLProgram program;
@@ -572,28 +1178,82 @@ static struct {
 
 	struct {
 		GLuint binding;
+		/* Framebuffer of the last draw or clear, its depth is invalidated when they move on
+		 * to another one */
+		GLuint target;
+		int discard_depth;
 	} framebuffer;
 
+	struct {
+		GLuint array, element_array, uniform, draw_indirect, pixel_unpack, pixel_pack;
+	} buffers;
+
+	struct {
+		GLuint buffer;
+		GLintptr offset;
+		GLsizei size;
+	} uniform_buffers[ATTO_GL_MAX_UNIFORM_BUFFER_BINDINGS];
+
+	GLuint vertex_array;
+
 	struct {
 		unsigned x, y, w, h;
 	} viewport;
 
+	struct {
+		GLint active;
+		GLuint bound[ATTO_GL_MAX_TEXTURE_UNITS][AGLTT_2DArray + 1]; /* indexed by AGLTextureType */
+		GLuint samplers[ATTO_GL_MAX_TEXTURE_UNITS];
+	} textures;
+
+	struct A__GLUniformShadow uniforms[ATTO_GL_UNIFORM_CACHE_SIZE];
+
 	AGLStats stats;
+
+	AGLCommandBuffer *command_buffer;
+
+	const char *program_cache;
+
+	struct {
+		struct {
+			const char *names[ATTO_GL_GPU_TIMER_PASSES];
+			GLuint queries[ATTO_GL_GPU_TIMER_PASSES];
+			int count;
+		} frames[ATTO_GL_GPU_TIMER_FRAMES];
+		int frame;
+		int running; /* a query is open */
+	} gpu_timer;
+
+	struct {
+		AGLRenderTarget targets[ATTO_GL_RENDER_TARGET_POOL_SIZE];
+		unsigned frame;
+	} render_targets;
 } a__gl_state;
 
 static GLuint a__GLCreateShader(int type, const char *const *source);
 static void a__GLProgramBind(AGLProgram program, const AGLProgramUniform *uniforms, int nuniforms);
-static void a__GLTextureBind(const AGLTexture *texture, GLint unit);
+static void a__GLTextureUnitBind(GLint unit, AGLTextureType type, GLuint name);
+static void a__GLBufferBind(GLenum target, GLuint name);
+static void a__GLVertexArrayBind(GLuint name);
+static void a__GLVertexLayoutBind(const AGLVertexLayout *layout);
+static void a__GLTextureBind(const AGLTexture *texture, const AGLSampler *sampler, GLint unit);
 static void a__GLAttribsBind(const AGLAttribute *attrs, int nattrs);
 static void a__GLCullingBind(AGLCullMode cull, AGLFrontFace front);
 static void a__GLDepthBind(AGLDepthParams depth);
 static void a__GLBlendBind(const AGLBlendParams *blend);
 static void a__GLFramebufferBind(const AGLFramebuffer *fbo);
+static void a__GLFramebufferInvalidate(GLsizei count, const GLenum *attachments);
 static void a__GLTargetBind(const AGLDrawTarget *target);
 
+/* Default framebuffer attachments: GL_COLOR and GL_DEPTH, or GL_COLOR_EXT and GL_DEPTH_EXT
+ * for glDiscardFramebufferEXT(), which GLES2 headers lack the former for */
+#define A__GL_DEFAULT_COLOR 0x1800
+#define A__GL_DEFAULT_DEPTH 0x1801
+
 #ifdef ATTO_PLATFORM_WINDOWS
 #define ATTO__DECLARE_FUNC(T_, N_) T_ N_ = 0;
 ATTO__GL_FUNCS_LIST(ATTO__DECLARE_FUNC)
+ATTO__GL_FUNCS_LIST_OPTIONAL(ATTO__DECLARE_FUNC)
 #undef ATTO__DECLARE_FUNC
 
 static PROC a__check_get_proc_address(const char *name) {
@@ -603,6 +1263,216 @@ static PROC a__check_get_proc_address(const char *name) {
 }
 #endif /* ifdef ATTO_PLATFORM_WINDOWS */
 
+#if defined(ATTO_EGL) || defined(ATTO_PLATFORM_EGL)
+#include <EGL/egl.h> /* eglGetProcAddress() */
+#endif
+
+#ifdef GL_APIENTRYP
+#define A__GL_APIENTRYP GL_APIENTRYP
+#elif defined(APIENTRYP)
+#define A__GL_APIENTRYP APIENTRYP
+#else
+#define A__GL_APIENTRYP *
+#endif
+
+/* GLES extensions that headers declare only with GL_GLEXT_PROTOTYPES, or not at all on
+ * desktop, so they are always looked up at aGLInit(). NULL if not exported. */
+typedef void (*a__gl_proc)(void);
+typedef void(A__GL_APIENTRYP a__gl_discard_framebuffer_func)(GLenum target, GLsizei count, const GLenum *attachments);
+typedef void(A__GL_APIENTRYP a__gl_renderbuffer_storage_multisample_func)(
+	GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void(A__GL_APIENTRYP a__gl_framebuffer_texture_2d_multisample_func)(
+	GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level, GLsizei samples);
+static struct {
+	a__gl_discard_framebuffer_func DiscardFramebufferEXT;
+	a__gl_renderbuffer_storage_multisample_func RenderbufferStorageMultisampleEXT;
+	a__gl_framebuffer_texture_2d_multisample_func FramebufferTexture2DMultisampleEXT;
+} a__gl_ext;
+
+/* GL_MAX_SAMPLES_EXT */
+#define A__GL_MAX_SAMPLES_EXT 0x8D57
+
+static a__gl_proc a__GLGetProcAddress(const char *name) {
+#if defined(ATTO_PLATFORM_WINDOWS)
+	return (a__gl_proc)wglGetProcAddress(name);
+#elif defined(ATTO_EGL) || defined(ATTO_PLATFORM_EGL)
+	return (a__gl_proc)eglGetProcAddress(name);
+#elif defined(ATTO_PLATFORM_X11)
+	return (a__gl_proc)glXGetProcAddressARB((const GLubyte *)name);
+#else
+	(void)name;
+	return NULL;
+#endif
+}
+
+AGLCapabilities a_gl_capabilities;
+
+static int a__GLVersionAtLeast(int major, int minor) {
+	const AGLCapabilities *caps = &a_gl_capabilities;
+	return caps->version_major > major || (caps->version_major == major && caps->version_minor >= minor);
+}
+
+static int a__GLHasExtension(const char *name) {
+#ifdef GL_NUM_EXTENSIONS
+	/* Core profiles don't have GL_EXTENSIONS for glGetString() */
+	if (a__GLVersionAtLeast(3, 0)) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; ++i) {
+			const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+			if (ext && strcmp(ext, name) == 0)
+				return 1;
+		}
+		return 0;
+	}
+#endif
+
+	const char *const extensions = (const char *)glGetString(GL_EXTENSIONS);
+	const size_t len = strlen(name);
+	const char *ext = extensions;
+	while (ext && (ext = strstr(ext, name))) {
+		if ((ext == extensions || ext[-1] == ' ') && (ext[len] == ' ' || ext[len] == '\0'))
+			return 1;
+		ext += len;
+	}
+	return 0;
+}
+
+static void a__GLCapabilitiesDetect(void) {
+	static const char es_prefix[] = "OpenGL ES ";
+	AGLCapabilities *caps = &a_gl_capabilities;
+	const char *version = (const char *)glGetString(GL_VERSION);
+	char *end;
+
+	memset(caps, 0, sizeof(*caps));
+	if (!version)
+		return;
+
+	if (strncmp(version, es_prefix, sizeof(es_prefix) - 1) == 0) {
+		caps->es = 1;
+		version += sizeof(es_prefix) - 1;
+	}
+	caps->version_major = (int)strtol(version, &end, 10);
+	if (*end == '.')
+		caps->version_minor = (int)strtol(end + 1, NULL, 10);
+
+#ifdef GL_VERTEX_ARRAY_BINDING
+	caps->vertex_array_object = a__GLVersionAtLeast(3, 0) || a__GLHasExtension("GL_ARB_vertex_array_object");
+#endif
+#ifdef GL_MAP_UNSYNCHRONIZED_BIT
+	caps->map_buffer_range = a__GLVersionAtLeast(3, 0) || a__GLHasExtension("GL_ARB_map_buffer_range");
+#endif
+#ifdef GL_COPY_READ_BUFFER
+	caps->copy_buffer =
+		caps->es ? a__GLVersionAtLeast(3, 0) : (a__GLVersionAtLeast(3, 1) || a__GLHasExtension("GL_ARB_copy_buffer"));
+#endif
+#ifdef GL_UNIFORM_BUFFER
+	caps->uniform_buffer = caps->es ? a__GLVersionAtLeast(3, 0)
+		: (a__GLVersionAtLeast(3, 1) || a__GLHasExtension("GL_ARB_uniform_buffer_object"));
+	if (caps->uniform_buffer)
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &caps->uniform_buffer_offset_alignment);
+#endif
+#ifdef GL_VERTEX_ATTRIB_ARRAY_DIVISOR
+	caps->instancing = caps->es ? a__GLVersionAtLeast(3, 0) : a__GLVersionAtLeast(3, 3);
+#endif
+#ifdef GL_VERSION_1_4
+	caps->multi_draw = !caps->es && a__GLVersionAtLeast(1, 4);
+#endif
+#ifdef GL_TIME_ELAPSED
+	caps->timer_query = !caps->es && (a__GLVersionAtLeast(3, 3) || a__GLHasExtension("GL_ARB_timer_query"));
+#endif
+#ifdef GL_PROGRAM_BINARY_LENGTH
+	caps->program_binary = caps->es ? a__GLVersionAtLeast(3, 0)
+		: (a__GLVersionAtLeast(4, 1) || a__GLHasExtension("GL_ARB_get_program_binary"));
+	if (caps->program_binary) {
+		/* Drivers may support the API but not a single binary format */
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		caps->program_binary = formats > 0;
+	}
+#endif
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	caps->pixel_buffer = caps->es ? a__GLVersionAtLeast(3, 0)
+		: (a__GLVersionAtLeast(2, 1) || a__GLHasExtension("GL_ARB_pixel_buffer_object"));
+#endif
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+	caps->sync = caps->es ? a__GLVersionAtLeast(3, 0) : (a__GLVersionAtLeast(3, 2) || a__GLHasExtension("GL_ARB_sync"));
+#endif
+#ifdef GL_COMPRESSED_RGB8_ETC2
+	caps->texture_etc2 = caps->es ? a__GLVersionAtLeast(3, 0)
+		: (a__GLVersionAtLeast(4, 3) || a__GLHasExtension("GL_ARB_ES3_compatibility"));
+#endif
+	/* ETC2 decoders read ETC1 data */
+	caps->texture_etc1 = caps->texture_etc2;
+#ifdef GL_ETC1_RGB8_OES
+	caps->texture_etc1 = caps->texture_etc1 || a__GLHasExtension("GL_OES_compressed_ETC1_RGB8_texture");
+#endif
+#ifdef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	caps->texture_s3tc = a__GLHasExtension("GL_EXT_texture_compression_s3tc");
+#endif
+#ifdef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	caps->texture_dxt1 = caps->texture_s3tc || a__GLHasExtension("GL_EXT_texture_compression_dxt1");
+#endif
+#ifdef GL_COMPRESSED_RGBA_BPTC_UNORM
+	caps->texture_bptc = !caps->es && (a__GLVersionAtLeast(4, 2) || a__GLHasExtension("GL_ARB_texture_compression_bptc"));
+#endif
+#ifdef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+	caps->texture_astc =
+		(caps->es && a__GLVersionAtLeast(3, 2)) || a__GLHasExtension("GL_KHR_texture_compression_astc_ldr");
+#endif
+#ifdef GL_COMPLETION_STATUS_KHR
+	caps->parallel_shader_compile = a__GLHasExtension("GL_KHR_parallel_shader_compile") ||
+		a__GLHasExtension("GL_ARB_parallel_shader_compile");
+#endif
+#ifdef GL_SAMPLER_BINDING
+	caps->sampler_objects = caps->es ? a__GLVersionAtLeast(3, 0)
+		: (a__GLVersionAtLeast(3, 3) || a__GLHasExtension("GL_ARB_sampler_objects"));
+#endif
+	caps->max_anisotropy = 1.f;
+#ifdef GL_TEXTURE_MAX_ANISOTROPY_EXT
+	if (a__GLVersionAtLeast(4, 6) || a__GLHasExtension("GL_EXT_texture_filter_anisotropic") ||
+		a__GLHasExtension("GL_ARB_texture_filter_anisotropic"))
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &caps->max_anisotropy);
+#endif
+#ifdef GL_READ_FRAMEBUFFER
+	if (caps->es ? a__GLVersionAtLeast(3, 0)
+			: (a__GLVersionAtLeast(3, 0) || a__GLHasExtension("GL_ARB_framebuffer_object")))
+		glGetIntegerv(GL_MAX_SAMPLES, &caps->max_samples);
+#endif
+	caps->multisampled_render_to_texture = a__GLHasExtension("GL_EXT_multisampled_render_to_texture") &&
+		a__gl_ext.RenderbufferStorageMultisampleEXT && a__gl_ext.FramebufferTexture2DMultisampleEXT;
+	if (caps->multisampled_render_to_texture)
+		glGetIntegerv(A__GL_MAX_SAMPLES_EXT, &caps->max_samples);
+	if (caps->max_samples < 2)
+		caps->max_samples = 0;
+#if defined(GL_VERSION_4_3) || defined(GL_ES_VERSION_3_0)
+	caps->invalidate_framebuffer = caps->es ? a__GLVersionAtLeast(3, 0)
+		: (a__GLVersionAtLeast(4, 3) || a__GLHasExtension("GL_ARB_invalidate_subdata"));
+#endif
+	caps->discard_framebuffer =
+		caps->es && a__GLHasExtension("GL_EXT_discard_framebuffer") && a__gl_ext.DiscardFramebufferEXT;
+	caps->max_draw_buffers = 1;
+#ifdef GL_MAX_DRAW_BUFFERS
+	if (caps->es ? a__GLVersionAtLeast(3, 0) : a__GLVersionAtLeast(2, 0)) {
+		GLint attachments = 1;
+		glGetIntegerv(GL_MAX_DRAW_BUFFERS, &caps->max_draw_buffers);
+#ifdef GL_MAX_COLOR_ATTACHMENTS
+		glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &attachments);
+		if (attachments < caps->max_draw_buffers)
+			caps->max_draw_buffers = attachments;
+#endif
+		if (caps->max_draw_buffers < 1)
+			caps->max_draw_buffers = 1;
+		if (caps->max_draw_buffers > ATTO_GL_MAX_COLOR_ATTACHMENTS)
+			caps->max_draw_buffers = ATTO_GL_MAX_COLOR_ATTACHMENTS;
+	}
+#endif
+#ifdef GL_VERSION_4_3
+	caps->multi_draw_indirect =
+		!caps->es && (a__GLVersionAtLeast(4, 3) || a__GLHasExtension("GL_ARB_multi_draw_indirect"));
+#endif
+}
+
 #ifdef ATTO_GL_PRINT_LIMITS
 #define A__GL_PRINT_LIMIT(enum, num) a__GlGetAndPrintInteger(enum, #enum, num)
 static void a__GlGetAndPrintInteger(GLenum pname, const char *name, int count) {
@@ -620,8 +1490,17 @@ void aGLInit(void) {
 #define ATTO__GET_FUNC(T_, N_) N_ = (T_)a__check_get_proc_address(#N_);
 	ATTO__GL_FUNCS_LIST(ATTO__GET_FUNC)
 #undef ATTO__GET_FUNC
+#define ATTO__GET_FUNC_OPTIONAL(T_, N_) N_ = (T_)wglGetProcAddress(#N_);
+	ATTO__GL_FUNCS_LIST_OPTIONAL(ATTO__GET_FUNC_OPTIONAL)
+#undef ATTO__GET_FUNC_OPTIONAL
 #endif /* ifdef ATTO_PLATFORM_WINDOWS */
 
+	a__gl_ext.DiscardFramebufferEXT = (a__gl_discard_framebuffer_func)a__GLGetProcAddress("glDiscardFramebufferEXT");
+	a__gl_ext.RenderbufferStorageMultisampleEXT =
+		(a__gl_renderbuffer_storage_multisample_func)a__GLGetProcAddress("glRenderbufferStorageMultisampleEXT");
+	a__gl_ext.FramebufferTexture2DMultisampleEXT =
+		(a__gl_framebuffer_texture_2d_multisample_func)a__GLGetProcAddress("glFramebufferTexture2DMultisampleEXT");
+
 #ifndef ATTO_GL_DONT_PRINT_INFO
 	AGL_PRINTFLN("GL_VENDOR: %s", glGetString(GL_VENDOR));
 	AGL_PRINTFLN("GL_RENDERER: %s", glGetString(GL_RENDERER));
@@ -839,6 +1718,8 @@ void aGLInit(void) {
 	glGetError();
 #endif
 
+	a__GLCapabilitiesDetect();
+
 	/* default initial GL state */
 	a__gl_state.cull_mode = AGLCM_Disable;
 	a__gl_state.front_face = AGLFF_CounterClockwise;
@@ -855,38 +1736,228 @@ void aGLInit(void) {
 	}
 }
 
-GLint aGLProgramCreate(const char *const *vertex, const char *const *fragment) {
-	GLuint program;
-	GLuint vertex_shader, fragment_shader;
-	fragment_shader = a__GLCreateShader(GL_FRAGMENT_SHADER, fragment);
-	if (fragment_shader == 0)
-		return -1;
+void aGLProgramCacheSet(const char *directory) {
+	a__gl_state.program_cache = directory;
+}
+
+/* Program name might have been recycled, forget its old binding and uniform values */
+static void a__GLProgramForget(GLuint program) {
+	if (a__gl_state.program == (AGLProgram)program)
+		a__gl_state.program = 0;
+	for (int i = 0; i < ATTO_GL_UNIFORM_CACHE_SIZE; ++i)
+		if (a__gl_state.uniforms[i].program == (AGLProgram)program)
+			a__gl_state.uniforms[i].program = 0;
+}
+
+#ifdef GL_PROGRAM_BINARY_LENGTH
+#define A__GL_PROGRAM_CACHE_MAGIC 0x504c4741u /* "AGLP" */
+
+struct A__GLProgramCacheHeader {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t length;
+};
+
+/* FNV-1a, the terminator is hashed too to separate consecutive strings */
+static uint64_t a__GLHashString(uint64_t hash, const char *str) {
+	do {
+		hash = (hash ^ (unsigned char)*str) * 0x100000001b3ull;
+	} while (*str++);
+	return hash;
+}
 
-	vertex_shader = a__GLCreateShader(GL_VERTEX_SHADER, vertex);
-	if (vertex_shader == 0) {
-		AGL__CALL(glDeleteShader(fragment_shader));
-		return -2;
+/* Returns 0 if programs shouldn't be cached */
+static int a__GLProgramCacheKey(const char *const *vertex, const char *const *fragment, uint64_t *key) {
+	const char *renderer, *version;
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	if (!a__gl_state.program_cache || !a_gl_capabilities.program_binary)
+		return 0;
+
+	renderer = (const char *)glGetString(GL_RENDERER);
+	version = (const char *)glGetString(GL_VERSION);
+	for (; *vertex; ++vertex)
+		hash = a__GLHashString(hash, *vertex);
+	hash = a__GLHashString(hash, "");
+	for (; *fragment; ++fragment)
+		hash = a__GLHashString(hash, *fragment);
+	hash = a__GLHashString(hash, "");
+	hash = a__GLHashString(hash, renderer ? renderer : "");
+	hash = a__GLHashString(hash, version ? version : "");
+
+	*key = hash;
+	return 1;
+}
+
+static int a__GLProgramCachePath(uint64_t key, char *path, size_t size) {
+	const int written = snprintf(path, size, "%s/%08x%08x.aglp", a__gl_state.program_cache,
+		(unsigned)(key >> 32), (unsigned)(key & 0xffffffffu));
+	return written > 0 && (size_t)written < size;
+}
+
+static GLuint a__GLProgramCacheLoad(const char *path) {
+	struct A__GLProgramCacheHeader header;
+	void *binary = NULL;
+	GLuint program = 0;
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return 0;
+
+	if (fread(&header, sizeof(header), 1, f) == 1 && header.magic == A__GL_PROGRAM_CACHE_MAGIC && header.length > 0 &&
+		(binary = malloc(header.length)) != NULL && fread(binary, header.length, 1, f) == 1) {
+		GLint status = GL_FALSE;
+		program = glCreateProgram();
+
+		/* Unsupported format is an error rather than a failed link, neither is fatal here.
+		 * Errors left pending by earlier unchecked calls must not be blamed on the binary */
+		for (int i = 0; i < 8 && glGetError() != GL_NO_ERROR; ++i) {
+		}
+		glProgramBinary(program, header.format, binary, (GLsizei)header.length);
+		if (glGetError() == GL_NO_ERROR)
+			AGL__CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
+		if (status != GL_TRUE) {
+			AGL__CALL(glDeleteProgram(program));
+			program = 0;
+		}
 	}
 
-	program = glCreateProgram();
-	AGL__CALL(glAttachShader(program, fragment_shader));
-	AGL__CALL(glAttachShader(program, vertex_shader));
-	AGL__CALL(glLinkProgram(program));
+	free(binary);
+	fclose(f);
+	return program;
+}
 
-	AGL__CALL(glDeleteShader(fragment_shader));
-	AGL__CALL(glDeleteShader(vertex_shader));
+static void a__GLProgramCacheStore(GLuint program, const char *path) {
+	struct A__GLProgramCacheHeader header = {A__GL_PROGRAM_CACHE_MAGIC, 0, 0};
+	GLint length = 0;
+	GLsizei written = 0;
+	GLenum format = 0;
+	char temp[ATTO_GL_PROGRAM_CACHE_PATH_SIZE + 4];
+	void *binary;
+	FILE *f;
+
+	/* Written next to the final file and renamed, so that a crash never leaves it truncated */
+	const int temp_length = snprintf(temp, sizeof(temp), "%s.tmp", path);
+	if (temp_length <= 0 || (size_t)temp_length >= sizeof(temp))
+		return;
 
-	{
-		GLint status;
+	AGL__CALL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+	if (length <= 0 || (binary = malloc(length)) == NULL)
+		return;
+
+	AGL__CALL(glGetProgramBinary(program, length, &written, &format, binary));
+	header.format = format;
+	header.length = (uint32_t)written;
+
+	if (written > 0 && (f = fopen(temp, "wb")) != NULL) {
+		const int ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(binary, written, 1, f) == 1;
+		if (fclose(f) != 0 || !ok) {
+			remove(temp);
+		} else if (rename(temp, path) != 0) {
+			/* Windows doesn't replace existing files */
+			remove(path);
+			if (rename(temp, path) != 0)
+				remove(temp);
+		}
+	}
+
+	free(binary);
+}
+#endif /* ifdef GL_PROGRAM_BINARY_LENGTH */
+
+AGLProgramAsync aGLProgramCreateAsync(const char *const *vertex, const char *const *fragment) {
+	AGLProgramAsync async = {0};
+#ifdef GL_PROGRAM_BINARY_LENGTH
+	char cache_path[ATTO_GL_PROGRAM_CACHE_PATH_SIZE];
+	async._.cache = a__GLProgramCacheKey(vertex, fragment, &async._.cache_key) &&
+		a__GLProgramCachePath(async._.cache_key, cache_path, sizeof(cache_path));
+	if (async._.cache && (async._.program = a__GLProgramCacheLoad(cache_path)) != 0) {
+		a__GLProgramForget(async._.program);
+		async.program = async._.program;
+		return async;
+	}
+#endif
+
+	/* Nothing here waits for the compiler, status is only queried on poll */
+	async._.fragment = a__GLCreateShader(GL_FRAGMENT_SHADER, fragment);
+	async._.vertex = a__GLCreateShader(GL_VERTEX_SHADER, vertex);
+
+	async._.program = glCreateProgram();
+#ifdef GL_PROGRAM_BINARY_LENGTH
+	if (async._.cache)
+		AGL__CALL(glProgramParameteri(async._.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+#endif
+	AGL__CALL(glAttachShader(async._.program, async._.fragment));
+	AGL__CALL(glAttachShader(async._.program, async._.vertex));
+	AGL__CALL(glLinkProgram(async._.program));
+
+	a__GLProgramForget(async._.program);
+	return async;
+}
+
+static int a__GLShaderCompiled(GLuint shader) {
+	GLint status;
+	AGL__CALL(glGetShaderiv(shader, GL_COMPILE_STATUS, &status));
+	if (status != GL_TRUE)
+		AGL__CALL(glGetShaderInfoLog(shader, sizeof(a_gl_error), 0, a_gl_error));
+	return status == GL_TRUE;
+}
+
+/* Checks statuses, blocking if compilation hasn't finished yet */
+static AGLProgram a__GLProgramFinish(AGLProgramAsync *async) {
+	const GLuint program = async->_.program;
+	GLint status;
+
+	if (!a__GLShaderCompiled(async->_.fragment))
+		async->program = -1;
+	else if (!a__GLShaderCompiled(async->_.vertex))
+		async->program = -2;
+	else {
 		AGL__CALL(glGetProgramiv(program, GL_LINK_STATUS, &status));
 		if (status != GL_TRUE) {
 			AGL__CALL(glGetProgramInfoLog(program, sizeof(a_gl_error), 0, a_gl_error));
-			AGL__CALL(glDeleteProgram(program));
-			return -3;
+			async->program = -3;
+		} else {
+			async->program = program;
 		}
 	}
 
-	return program;
+	AGL__CALL(glDeleteShader(async->_.fragment));
+	AGL__CALL(glDeleteShader(async->_.vertex));
+	if (async->program < 0) {
+		AGL__CALL(glDeleteProgram(program));
+		return async->program;
+	}
+
+#ifdef GL_PROGRAM_BINARY_LENGTH
+	if (async->_.cache) {
+		char cache_path[ATTO_GL_PROGRAM_CACHE_PATH_SIZE];
+		a__GLProgramCachePath(async->_.cache_key, cache_path, sizeof(cache_path));
+		a__GLProgramCacheStore(program, cache_path);
+	}
+#endif
+
+	return async->program;
+}
+
+int aGLProgramPoll(AGLProgramAsync *async) {
+	if (async->program)
+		return async->program > 0 ? 1 : async->program;
+
+#ifdef GL_COMPLETION_STATUS_KHR
+	if (a_gl_capabilities.parallel_shader_compile) {
+		GLint completed = GL_FALSE;
+		AGL__CALL(glGetProgramiv(async->_.program, GL_COMPLETION_STATUS_KHR, &completed));
+		if (completed != GL_TRUE)
+			return 0;
+	}
+#endif
+
+	return a__GLProgramFinish(async) > 0 ? 1 : async->program;
+}
+
+GLint aGLProgramCreate(const char *const *vertex, const char *const *fragment) {
+	AGLProgramAsync async = aGLProgramCreateAsync(vertex, fragment);
+	return async.program ? async.program : a__GLProgramFinish(&async);
 }
 
 GLint aGLProgramCreateSimple(const char *vertex, const char *fragment) {
@@ -902,33 +1973,343 @@ void aGLUniformLocate(AGLProgram program, AGLProgramUniform *uniforms, int count
 		uniforms[i]._.location = glGetUniformLocation(program, uniforms[i].name);
 }
 
-void aGLAttributeLocate(AGLProgram program, AGLAttribute *attribs, int count) {
-	for (int i = 0; i < count; ++i)
-		attribs[i]._.location = glGetAttribLocation(program, attribs[i].name);
+void aGLUniformBlockLocate(AGLProgram program, AGLUniformBlock *blocks, int count) {
+#ifdef GL_UNIFORM_BUFFER
+	ATTO_ASSERT(a_gl_capabilities.uniform_buffer);
+	for (int i = 0; i < count; ++i) {
+		blocks[i]._.index = glGetUniformBlockIndex(program, blocks[i].name);
+		if (blocks[i]._.index != GL_INVALID_INDEX)
+			AGL__CALL(glUniformBlockBinding(program, blocks[i]._.index, blocks[i].binding));
+	}
+#else
+	(void)program;
+	(void)blocks;
+	(void)count;
+	ATTO_ASSERT(!"Uniform blocks are not supported");
+#endif
 }
 
-AGLTexture aGLTextureCreate(const AGLTextureData *data) {
-	AGLTexture tex = {
-		.type = data->type,
-		.format = AGLTF_Unknown,
-		._.mag_filter = tex._.min_filter = (GLenum)-1,
-		._.wrap_s = tex._.wrap_t = (GLenum)-1,
-		.mag_filter = AGLTMF_Linear,
-		.min_filter = (data->flags & AGLTUF_GenerateMipmaps)
-			? AGLTmF_LinearMipLinear
-			: AGLTmF_Linear,
-		.wrap_s = tex.wrap_t = AGLTW_Repeat,
-	};
+void aGLUniformBufferBind(GLuint binding, const AGLBuffer *buffer, GLintptr offset, GLsizei size) {
+#ifdef GL_UNIFORM_BUFFER
+	ATTO_ASSERT(binding < ATTO_GL_MAX_UNIFORM_BUFFER_BINDINGS);
+	if (a__gl_state.uniform_buffers[binding].buffer == buffer->name &&
+		a__gl_state.uniform_buffers[binding].offset == offset && a__gl_state.uniform_buffers[binding].size == size)
+		return;
+
+	AGL__CALL(glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer->name, offset, size));
+	++a__gl_state.stats.buffer_binds;
+	a__gl_state.uniform_buffers[binding].buffer = buffer->name;
+	a__gl_state.uniform_buffers[binding].offset = offset;
+	a__gl_state.uniform_buffers[binding].size = size;
+	/* Also binds the generic binding point */
+	a__gl_state.buffers.uniform = buffer->name;
+#else
+	(void)binding;
+	(void)buffer;
+	(void)offset;
+	(void)size;
+	ATTO_ASSERT(!"Uniform blocks are not supported");
+#endif
+}
+
+GLintptr aGLUniformBlockPush(AGLStreamBuffer *stream, GLuint binding, const void *data, GLsizei size) {
+	const GLintptr offset =
+		aGLStreamBufferPush(stream, data, size, a_gl_capabilities.uniform_buffer_offset_alignment);
+	aGLUniformBufferBind(binding, &stream->buffer, offset, size);
+	return offset;
+}
+
+static GLsizei a__GLStd140Put(AGLStd140Writer *writer, GLsizei alignment, const void *value, GLsizei size) {
+	const GLsizei offset = (writer->offset + alignment - 1) / alignment * alignment;
+	ATTO_ASSERT(offset + size <= writer->size);
+	memset((char *)writer->data + writer->offset, 0, offset - writer->offset);
+	if (size)
+		memcpy((char *)writer->data + offset, value, size);
+	writer->offset = offset + size;
+	return offset;
+}
+
+GLsizei aGLStd140Float(AGLStd140Writer *writer, GLfloat value) {
+	return a__GLStd140Put(writer, 4, &value, sizeof(value));
+}
+
+GLsizei aGLStd140Int(AGLStd140Writer *writer, GLint value) {
+	return a__GLStd140Put(writer, 4, &value, sizeof(value));
+}
+
+GLsizei aGLStd140Vec2(AGLStd140Writer *writer, const GLfloat *value) {
+	return a__GLStd140Put(writer, 8, value, 2 * sizeof(*value));
+}
+
+GLsizei aGLStd140Vec3(AGLStd140Writer *writer, const GLfloat *value) {
+	return a__GLStd140Put(writer, 16, value, 3 * sizeof(*value));
+}
+
+GLsizei aGLStd140Vec4(AGLStd140Writer *writer, const GLfloat *value) {
+	return a__GLStd140Put(writer, 16, value, 4 * sizeof(*value));
+}
+
+/* Matrix columns are stored as vec4 */
+GLsizei aGLStd140Mat3(AGLStd140Writer *writer, const GLfloat *value) {
+	const GLfloat columns[12] = {
+		value[0], value[1], value[2], 0.f,
+		value[3], value[4], value[5], 0.f,
+		value[6], value[7], value[8], 0.f,
+	};
+	return a__GLStd140Put(writer, 16, columns, sizeof(columns));
+}
+
+GLsizei aGLStd140Mat4(AGLStd140Writer *writer, const GLfloat *value) {
+	return a__GLStd140Put(writer, 16, value, 16 * sizeof(*value));
+}
+
+GLsizei aGLStd140End(AGLStd140Writer *writer) {
+	a__GLStd140Put(writer, 16, NULL, 0);
+	return writer->offset;
+}
+
+void aGLAttributeLocate(AGLProgram program, AGLAttribute *attribs, int count) {
+	for (int i = 0; i < count; ++i)
+		attribs[i]._.location = glGetAttribLocation(program, attribs[i].name);
+}
+
+uint32_t aGLNameHash(const char *name) {
+	uint32_t hash = 0x811c9dc5u;
+	for (; *name; ++name)
+		hash = (hash ^ (unsigned char)*name) * 0x01000193u;
+	return hash;
+}
+
+static int a__GLProgramVariableCompare(const void *a, const void *b) {
+	const uint32_t ha = ((const AGLProgramVariable *)a)->hash, hb = ((const AGLProgramVariable *)b)->hash;
+	return (ha > hb) - (ha < hb);
+}
+
+/* Returns number of variables, or -1 if they don't fit */
+static int a__GLProgramReflectVariables(AGLProgram program, int uniforms, AGLProgramVariable *vars, unsigned capacity) {
+	GLint active = 0;
+	unsigned n = 0;
+
+	AGL__CALL(glGetProgramiv(program, uniforms ? GL_ACTIVE_UNIFORMS : GL_ACTIVE_ATTRIBUTES, &active));
+	for (GLint i = 0; i < active; ++i) {
+		char name[ATTO_GL_REFLECTION_NAME_SIZE];
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		GLint location;
+
+		if (uniforms)
+			AGL__CALL(glGetActiveUniform(program, (GLuint)i, sizeof(name), &length, &size, &type, name));
+		else
+			AGL__CALL(glGetActiveAttrib(program, (GLuint)i, sizeof(name), &length, &size, &type, name));
+		if (length >= (GLsizei)sizeof(name) - 1)
+			continue;
+
+		if (length > 3 && strcmp(name + length - 3, "[0]") == 0)
+			name[length - 3] = '\0';
+
+		/* Block members and built-ins have no location */
+		location = uniforms ? glGetUniformLocation(program, name) : glGetAttribLocation(program, name);
+		if (location < 0)
+			continue;
+
+		if (n == capacity)
+			return -1;
+
+		vars[n].hash = aGLNameHash(name);
+		vars[n].location = location;
+		vars[n].type = type;
+		vars[n].size = size;
+		++n;
+	}
+
+	qsort(vars, n, sizeof(*vars), a__GLProgramVariableCompare);
+	for (unsigned i = 1; i < n; ++i)
+		if (vars[i].hash == vars[i - 1].hash)
+			AGL_PRINTFLN("Program %d has two %s with the same name hash %#x", program,
+				uniforms ? "uniforms" : "attributes", vars[i].hash);
+
+	return (int)n;
+}
+
+int aGLProgramReflect(AGLProgram program, AGLProgramReflection *reflection) {
+	const int nuniforms = a__GLProgramReflectVariables(program, 1, reflection->uniforms, reflection->uniforms_capacity);
+	const int nattribs = a__GLProgramReflectVariables(program, 0, reflection->attribs, reflection->attribs_capacity);
+	reflection->nuniforms = nuniforms > 0 ? (unsigned)nuniforms : 0;
+	reflection->nattribs = nattribs > 0 ? (unsigned)nattribs : 0;
+	return nuniforms >= 0 && nattribs >= 0;
+}
+
+static const AGLProgramVariable *a__GLProgramVariableFind(const AGLProgramVariable *vars, unsigned n, uint32_t hash) {
+	unsigned lo = 0, hi = n;
+	while (lo < hi) {
+		const unsigned mid = lo + (hi - lo) / 2;
+		if (vars[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < n && vars[lo].hash == hash) ? vars + lo : NULL;
+}
+
+static int a__GLSamplerType(GLenum type) {
+	switch (type) {
+	case GL_SAMPLER_2D:
+	case GL_SAMPLER_CUBE:
+#ifdef GL_SAMPLER_1D
+	case GL_SAMPLER_1D:
+#endif
+#ifdef GL_SAMPLER_3D
+	case GL_SAMPLER_3D:
+#endif
+#ifdef GL_SAMPLER_2D_ARRAY
+	case GL_SAMPLER_2D_ARRAY:
+#endif
+#ifdef GL_SAMPLER_2D_SHADOW
+	case GL_SAMPLER_2D_SHADOW:
+#endif
+		return 1;
+	}
+	return 0;
+}
+
+static int a__GLUniformTypeMatches(AGLAttributeType type, GLenum gltype) {
+	switch (type) {
+	case AGLAT_Float: return gltype == GL_FLOAT;
+	case AGLAT_Vec2: return gltype == GL_FLOAT_VEC2;
+	case AGLAT_Vec3: return gltype == GL_FLOAT_VEC3;
+	case AGLAT_Vec4: return gltype == GL_FLOAT_VEC4;
+	case AGLAT_Mat2: return gltype == GL_FLOAT_MAT2;
+	case AGLAT_Mat3: return gltype == GL_FLOAT_MAT3;
+	case AGLAT_Mat4: return gltype == GL_FLOAT_MAT4;
+	case AGLAT_Int: return gltype == GL_INT || gltype == GL_BOOL;
+	case AGLAT_IVec2: return gltype == GL_INT_VEC2 || gltype == GL_BOOL_VEC2;
+	case AGLAT_IVec3: return gltype == GL_INT_VEC3 || gltype == GL_BOOL_VEC3;
+	case AGLAT_IVec4: return gltype == GL_INT_VEC4 || gltype == GL_BOOL_VEC4;
+	case AGLAT_Texture: return a__GLSamplerType(gltype);
+	}
+	return 0;
+}
+
+void aGLUniformLocateReflected(const AGLProgramReflection *reflection, AGLProgramUniform *uniforms, int count) {
+	for (int i = 0; i < count; ++i) {
+		AGLProgramUniform *u = uniforms + i;
+		const AGLProgramVariable *v;
+
+		if (!u->id)
+			u->id = aGLNameHash(u->name);
+
+		u->_.location = -1;
+		v = a__GLProgramVariableFind(reflection->uniforms, reflection->nuniforms, u->id);
+		if (!v)
+			continue;
+
+		if (!a__GLUniformTypeMatches(u->type, v->type) || u->count > v->size) {
+			AGL_PRINTFLN("Uniform %s (%#x) type %d[%d] does not match program type %#x[%d]", u->name ? u->name : "?",
+				u->id, u->type, u->count, v->type, v->size);
+			continue;
+		}
+
+		u->_.location = v->location;
+	}
+}
+
+void aGLAttributeLocateReflected(const AGLProgramReflection *reflection, AGLAttribute *attribs, int count) {
+	for (int i = 0; i < count; ++i) {
+		AGLAttribute *a = attribs + i;
+		const AGLProgramVariable *v;
+
+		if (!a->id)
+			a->id = aGLNameHash(a->name);
+
+		a->_.location = -1;
+		v = a__GLProgramVariableFind(reflection->attribs, reflection->nattribs, a->id);
+		if (!v)
+			continue;
+
+		/* glVertexAttribPointer can only feed float inputs */
+		if (v->type == GL_INT || v->type == GL_INT_VEC2 || v->type == GL_INT_VEC3 || v->type == GL_INT_VEC4) {
+			AGL_PRINTFLN("Attribute %s (%#x) is an integer input of type %#x", a->name ? a->name : "?", a->id, v->type);
+			continue;
+		}
+
+		a->_.location = v->location;
+	}
+}
+
+AGLTexture aGLTextureCreate(const AGLTextureData *data) {
+	AGLTexture tex = {
+		.type = data->type,
+		.format = AGLTF_Unknown,
+		._.mag_filter = tex._.min_filter = (GLenum)-1,
+		._.wrap_s = tex._.wrap_t = tex._.wrap_r = (GLenum)-1,
+		._.max_anisotropy = 1.f,
+		.mag_filter = AGLTMF_Linear,
+		.min_filter = (data->flags & AGLTUF_GenerateMipmaps)
+			? AGLTmF_LinearMipLinear
+			: AGLTmF_Linear,
+		.wrap_s = tex.wrap_t = tex.wrap_r = AGLTW_Repeat,
+		.max_anisotropy = 1.f,
+	};
+
+	AGL__CALL(glGenTextures(1, &tex._.name));
+
+	/* Texture name might have been recycled, forget bindings of the deleted one */
+	for (int i = 0; i < ATTO_GL_MAX_TEXTURE_UNITS; ++i)
+		for (int j = 0; j <= AGLTT_2DArray; ++j)
+			if (a__gl_state.textures.bound[i][j] == tex._.name)
+				a__gl_state.textures.bound[i][j] = 0;
 
-	AGL__CALL(glGenTextures(1, &tex._.name));
 	aGLTextureUpdate(&tex, data);
 	return tex;
 }
 
 struct A__GLTextureFormat {
 	GLenum internal, format, type;
+	/* Compressed formats only, 0 otherwise */
+	GLsizei block_width, block_height, block_size;
 };
 
+static struct A__GLTextureFormat a__GLCompressedFormat(GLenum internal, GLsizei block_width, GLsizei block_height, GLsizei block_size) {
+	struct A__GLTextureFormat tf = {0};
+	tf.internal = tf.format = internal;
+	tf.block_width = block_width;
+	tf.block_height = block_height;
+	tf.block_size = block_size;
+	return tf;
+}
+
+static GLsizei a__GLCompressedSize(struct A__GLTextureFormat tf, GLsizei width, GLsizei height, GLsizei depth) {
+	return (width + tf.block_width - 1) / tf.block_width * ((height + tf.block_height - 1) / tf.block_height) *
+		depth * tf.block_size;
+}
+
+static GLsizei a__GLTextureFormatPixelSize(AGLTextureFormat format) {
+	switch (format) {
+	case AGLTF_U8_R: return 1;
+	case AGLTF_U8_RA:
+	case AGLTF_U565_RGB:
+	case AGLTF_U5551_RGBA:
+	case AGLTF_U4444_RGBA: return 2;
+	case AGLTF_U8_RGB: return 3;
+	case AGLTF_U8_RGBA:
+	case AGLTF_F32_R: return 4;
+	case AGLTF_F32_RGBA: return 16;
+	case AGLTF_ETC1_RGB:
+	case AGLTF_ETC2_RGB:
+	case AGLTF_ETC2_RGBA:
+	case AGLTF_BC1_RGB:
+	case AGLTF_BC1_RGBA:
+	case AGLTF_BC2_RGBA:
+	case AGLTF_BC3_RGBA:
+	case AGLTF_BC7_RGBA:
+	case AGLTF_ASTC4x4_RGBA:
+	case AGLTF_ASTC8x8_RGBA: /* see a__GLCompressedSize() */
+	case AGLTF_Unknown: break;
+	}
+	return 0;
+}
+
 static struct A__GLTextureFormat getTextureFormat(AGLTextureFormat aformat) {
 	struct A__GLTextureFormat tf = {0};
 	switch (aformat) {
@@ -978,63 +2359,200 @@ static struct A__GLTextureFormat getTextureFormat(AGLTextureFormat aformat) {
 		ATTO_ASSERT(!"Unknown format");
 #endif
 		break;
+	case AGLTF_ETC1_RGB:
+#ifdef GL_COMPRESSED_RGB8_ETC2
+		if (a_gl_capabilities.texture_etc2) {
+			tf = a__GLCompressedFormat(GL_COMPRESSED_RGB8_ETC2, 4, 4, 8);
+			break;
+		}
+#endif
+#ifdef GL_ETC1_RGB8_OES
+		tf = a__GLCompressedFormat(GL_ETC1_RGB8_OES, 4, 4, 8);
+#endif
+		break;
+#ifdef GL_COMPRESSED_RGB8_ETC2
+	case AGLTF_ETC2_RGB: tf = a__GLCompressedFormat(GL_COMPRESSED_RGB8_ETC2, 4, 4, 8); break;
+	case AGLTF_ETC2_RGBA: tf = a__GLCompressedFormat(GL_COMPRESSED_RGBA8_ETC2_EAC, 4, 4, 16); break;
+#else
+	case AGLTF_ETC2_RGB:
+	case AGLTF_ETC2_RGBA: break;
+#endif
+#ifdef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	case AGLTF_BC1_RGB: tf = a__GLCompressedFormat(GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 4, 4, 8); break;
+	case AGLTF_BC1_RGBA: tf = a__GLCompressedFormat(GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 4, 4, 8); break;
+#else
+	case AGLTF_BC1_RGB:
+	case AGLTF_BC1_RGBA: break;
+#endif
+#ifdef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	case AGLTF_BC2_RGBA: tf = a__GLCompressedFormat(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 4, 4, 16); break;
+	case AGLTF_BC3_RGBA: tf = a__GLCompressedFormat(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 4, 4, 16); break;
+#else
+	case AGLTF_BC2_RGBA:
+	case AGLTF_BC3_RGBA: break;
+#endif
+#ifdef GL_COMPRESSED_RGBA_BPTC_UNORM
+	case AGLTF_BC7_RGBA: tf = a__GLCompressedFormat(GL_COMPRESSED_RGBA_BPTC_UNORM, 4, 4, 16); break;
+#else
+	case AGLTF_BC7_RGBA: break;
+#endif
+#ifdef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+	case AGLTF_ASTC4x4_RGBA: tf = a__GLCompressedFormat(GL_COMPRESSED_RGBA_ASTC_4x4_KHR, 4, 4, 16); break;
+	case AGLTF_ASTC8x8_RGBA: tf = a__GLCompressedFormat(GL_COMPRESSED_RGBA_ASTC_8x8_KHR, 8, 8, 16); break;
+#else
+	case AGLTF_ASTC4x4_RGBA:
+	case AGLTF_ASTC8x8_RGBA: break;
+#endif
 	case AGLTF_Unknown: ATTO_ASSERT(!"Unknown format");
 	}
 	ATTO_ASSERT(tf.internal != 0);
 	return tf;
 }
 
-typedef void (a__gl_texture_upload_func)(AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf);
+int aGLTextureFormatSupported(AGLTextureFormat format) {
+	const AGLCapabilities *caps = &a_gl_capabilities;
+	switch (format) {
+	case AGLTF_U8_R:
+	case AGLTF_U8_RA:
+	case AGLTF_U8_RGB:
+	case AGLTF_U8_RGBA:
+	case AGLTF_U565_RGB:
+	case AGLTF_U5551_RGBA:
+	case AGLTF_U4444_RGBA: return 1;
+	case AGLTF_F32_R:
+#ifdef GL_R32F
+		return 1;
+#else
+		return 0;
+#endif
+	case AGLTF_F32_RGBA:
+#ifdef GL_RGBA32F
+		return 1;
+#else
+		return 0;
+#endif
+	case AGLTF_ETC1_RGB: return caps->texture_etc1;
+	case AGLTF_ETC2_RGB:
+	case AGLTF_ETC2_RGBA: return caps->texture_etc2;
+	case AGLTF_BC1_RGB:
+	case AGLTF_BC1_RGBA: return caps->texture_dxt1;
+	case AGLTF_BC2_RGBA:
+	case AGLTF_BC3_RGBA: return caps->texture_s3tc;
+	case AGLTF_BC7_RGBA: return caps->texture_bptc;
+	case AGLTF_ASTC4x4_RGBA:
+	case AGLTF_ASTC8x8_RGBA: return caps->texture_astc;
+	case AGLTF_Unknown: break;
+	}
+	return 0;
+}
+
+AGLTextureFormat aGLTextureFormatPick(const AGLTextureFormat *formats, int count) {
+	for (int i = 0; i < count; ++i)
+		if (aGLTextureFormatSupported(formats[i]))
+			return formats[i];
+	return AGLTF_Unknown;
+}
+
+/* Compressed sub-images cover whole blocks, only the ones at the texture edge may be partial */
+static int a__GLBlockAligned(GLsizei size, GLsizei end, GLsizei texture_size, GLsizei block) {
+	return size % block == 0 || end == texture_size;
+}
+
+typedef void (a__gl_texture_upload_func)(
+	AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf, const AGLBuffer *unpack);
 
-static void a__GLTexureUpload1D(AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf) {
+/* Pixels are read from the bound unpack buffer, if any, so it must be unbound for client
+ * memory and for allocating storage without data */
+static void a__GLPixelUnpackBind(const AGLBuffer *buffer) {
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	if (buffer || a__gl_state.buffers.pixel_unpack)
+		a__GLBufferBind(GL_PIXEL_UNPACK_BUFFER, buffer ? buffer->name : 0);
+#else
+	ATTO_ASSERT(!buffer);
+#endif
+}
+
+static void a__GLTexureUpload1D(
+	AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf, const AGLBuffer *unpack) {
 	const int maxwidth = data->x + data->width;
 
 	const int expand = maxwidth > tex->width;
 	const int is_subimage = data->x > 0;
-	const void *const to_upload = (!is_subimage && data->pixels) ? data->pixels : NULL;
+	const int has_pixels = data->pixels || unpack;
+	const int to_upload = !is_subimage && has_pixels;
 
 	ATTO_ASSERT(binding == GL_TEXTURE_1D);
 
 	if (expand || to_upload) {
-		AGL__CALL(glTexImage1D(binding, 0, tf.internal, maxwidth, 0,
-			tf.format, tf.type, to_upload));
+		a__GLPixelUnpackBind(to_upload ? unpack : NULL);
+		if (tf.block_size)
+			AGL__CALL(glCompressedTexImage1D(binding, 0, tf.internal, maxwidth, 0,
+				a__GLCompressedSize(tf, maxwidth, 1, 1), to_upload ? data->pixels : NULL));
+		else
+			AGL__CALL(glTexImage1D(binding, 0, tf.internal, maxwidth, 0,
+				tf.format, tf.type, to_upload ? data->pixels : NULL));
 		tex->width = maxwidth;
 	}
 
 	if (is_subimage) {
-		ATTO_ASSERT(data->pixels);
-		AGL__CALL(glTexSubImage1D(binding, 0,
-			data->x, data->width,
-			tf.format, tf.type, data->pixels));
+		ATTO_ASSERT(has_pixels);
+		ATTO_ASSERT(!tf.block_size || data->x % tf.block_width == 0);
+		ATTO_ASSERT(!tf.block_size || a__GLBlockAligned(data->width, maxwidth, tex->width, tf.block_width));
+		a__GLPixelUnpackBind(unpack);
+		if (tf.block_size)
+			AGL__CALL(glCompressedTexSubImage1D(binding, 0,
+				data->x, data->width,
+				tf.format, a__GLCompressedSize(tf, data->width, 1, 1), data->pixels));
+		else
+			AGL__CALL(glTexSubImage1D(binding, 0,
+				data->x, data->width,
+				tf.format, tf.type, data->pixels));
 	}
 }
 
-static void a__GLTexureUpload2D(AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf) {
+static void a__GLTexureUpload2D(
+	AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf, const AGLBuffer *unpack) {
 	const int maxwidth = data->x + data->width;
 	const int maxheight = data->y + data->height;
 
 	const int expand = (maxwidth > tex->width) || (maxheight > tex->height);
 	const int is_subimage = (data->x > 0 || data->y > 0);
-	const void *const to_upload = (!is_subimage && data->pixels) ? data->pixels : NULL;
+	const int has_pixels = data->pixels || unpack;
+	const int to_upload = !is_subimage && has_pixels;
 
 	ATTO_ASSERT(binding == GL_TEXTURE_2D);
 
 	if (expand || to_upload) {
-		AGL__CALL(glTexImage2D(binding, 0, tf.internal, maxwidth, maxheight, 0,
-			tf.format, tf.type, to_upload));
+		a__GLPixelUnpackBind(to_upload ? unpack : NULL);
+		if (tf.block_size)
+			AGL__CALL(glCompressedTexImage2D(binding, 0, tf.internal, maxwidth, maxheight, 0,
+				a__GLCompressedSize(tf, maxwidth, maxheight, 1), to_upload ? data->pixels : NULL));
+		else
+			AGL__CALL(glTexImage2D(binding, 0, tf.internal, maxwidth, maxheight, 0,
+				tf.format, tf.type, to_upload ? data->pixels : NULL));
 		tex->width = maxwidth;
 		tex->height = maxheight;
 	}
 
 	if (is_subimage) {
-		ATTO_ASSERT(data->pixels);
-		AGL__CALL(glTexSubImage2D(binding, 0,
-			data->x, data->y, data->width, data->height,
-			tf.format, tf.type, data->pixels));
+		ATTO_ASSERT(has_pixels);
+		ATTO_ASSERT(!tf.block_size || (data->x % tf.block_width == 0 && data->y % tf.block_height == 0));
+		ATTO_ASSERT(!tf.block_size || (a__GLBlockAligned(data->width, maxwidth, tex->width, tf.block_width) &&
+			a__GLBlockAligned(data->height, maxheight, tex->height, tf.block_height)));
+		a__GLPixelUnpackBind(unpack);
+		if (tf.block_size)
+			AGL__CALL(glCompressedTexSubImage2D(binding, 0,
+				data->x, data->y, data->width, data->height,
+				tf.format, a__GLCompressedSize(tf, data->width, data->height, 1), data->pixels));
+		else
+			AGL__CALL(glTexSubImage2D(binding, 0,
+				data->x, data->y, data->width, data->height,
+				tf.format, tf.type, data->pixels));
 	}
 }
 
-static void a__GLTexureUpload3D(AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf) {
+static void a__GLTexureUpload3D(
+	AGLTexture *tex, const AGLTextureData *data, GLenum binding, struct A__GLTextureFormat tf, const AGLBuffer *unpack) {
 	const int maxwidth = data->x + data->width;
 	const int maxheight = data->y + data->height;
 	const int maxdepth = data->z + data->depth;
@@ -1043,29 +2561,46 @@ static void a__GLTexureUpload3D(AGLTexture *tex, const AGLTextureData *data, GLe
 		|| (maxheight > tex->height)
 		|| (maxdepth > tex->depth);
 	const int is_subimage = (data->x > 0 || data->y > 0 || data->z > 0);
-	const void *const to_upload = (!is_subimage && data->pixels) ? data->pixels : NULL;
+	const int has_pixels = data->pixels || unpack;
+	const int to_upload = !is_subimage && has_pixels;
 
 	ATTO_ASSERT(binding == GL_TEXTURE_3D || binding == GL_TEXTURE_2D_ARRAY);
 
 	if (expand || to_upload) {
-		AGL__CALL(glTexImage3D(binding, 0, tf.internal,
-			maxwidth, maxheight, maxdepth, 0,
-			tf.format, tf.type,
-			to_upload));
+		a__GLPixelUnpackBind(to_upload ? unpack : NULL);
+		if (tf.block_size)
+			AGL__CALL(glCompressedTexImage3D(binding, 0, tf.internal,
+				maxwidth, maxheight, maxdepth, 0,
+				a__GLCompressedSize(tf, maxwidth, maxheight, maxdepth),
+				to_upload ? data->pixels : NULL));
+		else
+			AGL__CALL(glTexImage3D(binding, 0, tf.internal,
+				maxwidth, maxheight, maxdepth, 0,
+				tf.format, tf.type,
+				to_upload ? data->pixels : NULL));
 		tex->width = maxwidth;
 		tex->height = maxheight;
 		tex->depth = maxdepth;
 	}
 
 	if (is_subimage) {
-		ATTO_ASSERT(data->pixels);
-		AGL__CALL(glTexSubImage3D(binding, 0,
-			data->x, data->y, data->z, data->width, data->height, data->depth,
-			tf.format, tf.type, data->pixels));
+		ATTO_ASSERT(has_pixels);
+		ATTO_ASSERT(!tf.block_size || (data->x % tf.block_width == 0 && data->y % tf.block_height == 0));
+		ATTO_ASSERT(!tf.block_size || (a__GLBlockAligned(data->width, maxwidth, tex->width, tf.block_width) &&
+			a__GLBlockAligned(data->height, maxheight, tex->height, tf.block_height)));
+		a__GLPixelUnpackBind(unpack);
+		if (tf.block_size)
+			AGL__CALL(glCompressedTexSubImage3D(binding, 0,
+				data->x, data->y, data->z, data->width, data->height, data->depth,
+				tf.format, a__GLCompressedSize(tf, data->width, data->height, data->depth), data->pixels));
+		else
+			AGL__CALL(glTexSubImage3D(binding, 0,
+				data->x, data->y, data->z, data->width, data->height, data->depth,
+				tf.format, tf.type, data->pixels));
 	}
 }
 
-void aGLTextureUpdate(AGLTexture *tex, const AGLTextureData *data) {
+static void a__GLTextureUpdate(AGLTexture *tex, const AGLTextureData *data, const AGLBuffer *unpack) {
 	ATTO_ASSERT(data->type == tex->type);
 
 	struct A__GLTextureFormat tf = getTextureFormat(data->format);
@@ -1094,56 +2629,557 @@ void aGLTextureUpdate(AGLTexture *tex, const AGLTextureData *data) {
 	}
 	ATTO_ASSERT(upload_func);
 
-	// TODO track bindings properly
-	AGL__CALL(glBindTexture(binding, tex->_.name));
+	a__GLTextureUnitBind(a__gl_state.textures.active, data->type, tex->_.name);
 
-	upload_func(tex, data, binding, tf);
+	upload_func(tex, data, binding, tf, unpack);
 
-	if (data->pixels && (data->flags & AGLTUF_GenerateMipmaps))
+	/* Unpack buffer contents were counted when they were uploaded */
+	if (data->pixels && !unpack)
+		a__gl_state.stats.bytes_uploaded += aGLTextureDataSize(data);
+
+	if ((data->pixels || unpack) && (data->flags & AGLTUF_GenerateMipmaps)) {
+		ATTO_ASSERT(!tf.block_size);
 		AGL__CALL(glGenerateMipmap(binding));
+	}
 
 	tex->format = data->format;
 }
 
+GLsizei aGLTextureDataSize(const AGLTextureData *data) {
+	const struct A__GLTextureFormat tf = getTextureFormat(data->format);
+	if (tf.block_size)
+		return a__GLCompressedSize(
+			tf, data->width, data->height > 0 ? data->height : 1, data->depth > 0 ? data->depth : 1);
+
+	const GLsizei packed = a__GLTextureFormatPixelSize(data->format) * data->width;
+	const GLsizei rows = (data->height > 0 ? data->height : 1) * (data->depth > 0 ? data->depth : 1);
+	return (packed + 3) / 4 * 4 * (rows - 1) + packed;
+}
+
+void aGLTextureUpdate(AGLTexture *tex, const AGLTextureData *data) {
+	a__GLTextureUpdate(tex, data, NULL);
+}
+
+void aGLTextureUpdateFromBuffer(AGLTexture *tex, const AGLTextureData *data, const AGLBuffer *buffer) {
+	ATTO_ASSERT(a_gl_capabilities.pixel_buffer);
+	a__GLTextureUpdate(tex, data, buffer);
+}
+
+void aGLTextureUpdateStream(AGLTexture *tex, const AGLTextureData *data, AGLStreamBuffer *stream) {
+	AGLTextureData staged = *data;
+
+	if (!a_gl_capabilities.pixel_buffer || !data->pixels) {
+		a__GLTextureUpdate(tex, data, NULL);
+		return;
+	}
+
+	/* Rows are aligned relative to the offset, keep it aligned too */
+	staged.pixels = (const void *)aGLStreamBufferPush(stream, data->pixels, aGLTextureDataSize(data), 16);
+	a__GLTextureUpdate(tex, &staged, &stream->buffer);
+}
+
 AGLBuffer aGLBufferCreate(AGLBufferType type) {
 	AGLBuffer buf;
 	AGL__CALL(glGenBuffers(1, &buf.name));
 	buf.type = type;
+	buf.usage = AGLBU_Static;
+	buf.size = 0;
+
+	/* Buffer name might have been recycled, GL has reset bindings of the deleted one to 0 */
+	if (a__gl_state.buffers.array == buf.name)
+		a__gl_state.buffers.array = 0;
+	if (a__gl_state.buffers.element_array == buf.name)
+		a__gl_state.buffers.element_array = 0;
+	if (a__gl_state.buffers.uniform == buf.name)
+		a__gl_state.buffers.uniform = 0;
+	if (a__gl_state.buffers.draw_indirect == buf.name)
+		a__gl_state.buffers.draw_indirect = 0;
+	if (a__gl_state.buffers.pixel_unpack == buf.name)
+		a__gl_state.buffers.pixel_unpack = 0;
+	if (a__gl_state.buffers.pixel_pack == buf.name)
+		a__gl_state.buffers.pixel_pack = 0;
+	for (int i = 0; i < ATTO_GL_MAX_UNIFORM_BUFFER_BINDINGS; ++i)
+		if (a__gl_state.uniform_buffers[i].buffer == buf.name)
+			a__gl_state.uniform_buffers[i].buffer = 0;
+	for (int i = 0; i < ATTO_GL_MAX_ATTRIBS; ++i)
+		if (a__gl_state.attribs[i].buffer == (GLint)buf.name)
+			a__gl_state.attribs[i].buffer = 0;
+
 	return buf;
 }
 
+static void a__GLBufferBind(GLenum target, GLuint name) {
+	GLuint *binding = NULL;
+	switch (target) {
+	case GL_ARRAY_BUFFER: binding = &a__gl_state.buffers.array; break;
+	case GL_ELEMENT_ARRAY_BUFFER: binding = &a__gl_state.buffers.element_array; break;
+#ifdef GL_UNIFORM_BUFFER
+	case GL_UNIFORM_BUFFER: binding = &a__gl_state.buffers.uniform; break;
+#endif
+#ifdef GL_DRAW_INDIRECT_BUFFER
+	case GL_DRAW_INDIRECT_BUFFER: binding = &a__gl_state.buffers.draw_indirect; break;
+#endif
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	case GL_PIXEL_UNPACK_BUFFER: binding = &a__gl_state.buffers.pixel_unpack; break;
+	case GL_PIXEL_PACK_BUFFER: binding = &a__gl_state.buffers.pixel_pack; break;
+#endif
+	}
+	ATTO_ASSERT(binding);
+
+	/* Element array binding is vertex array state, cache tracks the default one */
+	if (target == GL_ELEMENT_ARRAY_BUFFER)
+		a__GLVertexArrayBind(0);
+
+	if (*binding != name) {
+		AGL__CALL(glBindBuffer(target, *binding = name));
+		++a__gl_state.stats.buffer_binds;
+	}
+}
+
 void aGLBufferUpload(AGLBuffer *buffer, GLsizei size, const void *data) {
-	AGL__CALL(glBindBuffer(buffer->type, buffer->name));
-	AGL__CALL(glBufferData(buffer->type, size, data, GL_STATIC_DRAW));
+	a__GLBufferBind(buffer->type, buffer->name);
+	AGL__CALL(glBufferData(buffer->type, size, data, buffer->usage));
+	buffer->size = size;
+	if (data)
+		a__gl_state.stats.bytes_uploaded += size;
 }
 
-void aGLDraw(const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target) {
-	ATTO_GL_PROFILE_PREAMBLE
+/* Reallocates buffer storage, keeping its contents if it can. The buffer keeps its name, as
+ * vertex layouts refer to it */
+static void a__GLBufferGrow(AGLBuffer *buffer, GLsizei size) {
+#ifdef GL_COPY_READ_BUFFER
+	if (a_gl_capabilities.copy_buffer) {
+		GLuint copy;
+		AGL__CALL(glGenBuffers(1, &copy));
+		AGL__CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, copy));
+		AGL__CALL(glBufferData(GL_COPY_WRITE_BUFFER, buffer->size, NULL, GL_STREAM_COPY));
+		AGL__CALL(glBindBuffer(GL_COPY_READ_BUFFER, buffer->name));
+		AGL__CALL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, buffer->size));
+		AGL__CALL(glBufferData(GL_COPY_READ_BUFFER, size, NULL, buffer->usage));
+		AGL__CALL(glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, buffer->size));
+		AGL__CALL(glDeleteBuffers(1, &copy));
+		buffer->size = size;
+		return;
+	}
+#endif
+	a__GLBufferBind(buffer->type, buffer->name);
+	AGL__CALL(glBufferData(buffer->type, size, NULL, buffer->usage));
+	buffer->size = size;
+}
+
+void aGLBufferUpdate(AGLBuffer *buffer, GLsizei offset, GLsizei size, const void *data) {
+	if (data)
+		a__gl_state.stats.bytes_uploaded += size;
+
+	if (offset + size > buffer->size) {
+		if (offset > 0 && buffer->size > 0) {
+			/* Geometrically, so that a series of appends copies a linear amount of data */
+			a__GLBufferGrow(buffer, offset + size > buffer->size * 2 ? offset + size : buffer->size * 2);
+		} else {
+			a__GLBufferBind(buffer->type, buffer->name);
+			AGL__CALL(glBufferData(buffer->type, offset + size, offset ? NULL : data, buffer->usage));
+			buffer->size = offset + size;
+			if (!offset)
+				return;
+		}
+	}
+
+	a__GLBufferBind(buffer->type, buffer->name);
+	AGL__CALL(glBufferSubData(buffer->type, offset, size, data));
+}
+
+AGLStreamBuffer aGLStreamBufferCreate(AGLBufferType type, GLsizei size) {
+	AGLStreamBuffer stream = {
+		.buffer = aGLBufferCreate(type),
+		._.offset = 0,
+	};
+
+	stream.buffer.usage = AGLBU_Stream;
+	aGLBufferUpload(&stream.buffer, size, NULL);
+	return stream;
+}
+
+/* Allocates the next aligned range, wrapping around to the beginning if it doesn't fit */
+static GLsizei a__GLStreamBufferReserve(AGLStreamBuffer *stream, GLsizei size, GLsizei alignment, int *orphan) {
+	GLsizei offset = stream->_.offset;
+
+	ATTO_ASSERT(size <= stream->buffer.size);
+
+	if (alignment > 1)
+		offset = (offset + alignment - 1) / alignment * alignment;
+
+	*orphan = offset + size > stream->buffer.size;
+	if (*orphan)
+		offset = 0;
+
+	stream->_.offset = offset + size;
+	return offset;
+}
+
+void *aGLStreamBufferMap(AGLStreamBuffer *stream, GLsizei size, GLsizei alignment, GLintptr *offset) {
+#ifdef GL_MAP_UNSYNCHRONIZED_BIT
+	const GLenum type = stream->buffer.type;
+	int orphan;
+
+	if (!a_gl_capabilities.map_buffer_range || size <= 0)
+		return NULL;
+
+	*offset = a__GLStreamBufferReserve(stream, size, alignment, &orphan);
+	a__gl_state.stats.bytes_uploaded += size;
+	a__GLBufferBind(type, stream->buffer.name);
+
+	/* Appended ranges are never in use, so there is nothing to synchronize with */
+	const GLbitfield access = GL_MAP_WRITE_BIT |
+		(orphan ? GL_MAP_INVALIDATE_BUFFER_BIT : (GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	void *mapped = glMapBufferRange(type, *offset, size, access);
+	ATTO_ASSERT(mapped);
+	return mapped;
+#else
+	(void)stream;
+	(void)size;
+	(void)alignment;
+	(void)offset;
+	return NULL;
+#endif
+}
+
+void aGLStreamBufferUnmap(AGLStreamBuffer *stream) {
+#ifdef GL_MAP_UNSYNCHRONIZED_BIT
+	a__GLBufferBind(stream->buffer.type, stream->buffer.name);
+	AGL__CALL(glUnmapBuffer(stream->buffer.type));
+#else
+	(void)stream;
+#endif
+}
+
+GLintptr aGLStreamBufferPush(AGLStreamBuffer *stream, const void *data, GLsizei size, GLsizei alignment) {
+	const GLenum type = stream->buffer.type;
+	GLintptr offset;
+	int orphan;
+
+	if (size == 0)
+		return a__GLStreamBufferReserve(stream, size, alignment, &orphan);
+
+	void *mapped = aGLStreamBufferMap(stream, size, alignment, &offset);
+	if (mapped) {
+		memcpy(mapped, data, size);
+		aGLStreamBufferUnmap(stream);
+		return offset;
+	}
+
+	offset = a__GLStreamBufferReserve(stream, size, alignment, &orphan);
+	a__gl_state.stats.bytes_uploaded += size;
+	a__GLBufferBind(type, stream->buffer.name);
+	if (orphan)
+		AGL__CALL(glBufferData(type, stream->buffer.size, NULL, stream->buffer.usage));
+	AGL__CALL(glBufferSubData(type, offset, size, data));
+	return offset;
+}
+
+AGLVertexLayout aGLVertexLayoutCreate(const AGLAttribute *attribs, unsigned nattribs, const AGLBuffer *index_buffer) {
+	AGLVertexLayout layout = {
+		.attribs = attribs,
+		.nattribs = nattribs,
+		.index_buffer = index_buffer,
+		._.name = 0,
+	};
+
+#ifdef GL_VERTEX_ARRAY_BINDING
+	if (!a_gl_capabilities.vertex_array_object)
+		return layout;
+
+	/* Client-side arrays cannot be captured by a vertex array object, and emulated instancing
+	 * needs per-instance attributes set on each draw */
+	for (unsigned i = 0; i < nattribs; ++i)
+		if (attribs[i]._.location >= 0 &&
+			(!attribs[i].buffer || (attribs[i].divisor && !a_gl_capabilities.instancing)))
+			return layout;
+
+	AGL__CALL(glGenVertexArrays(1, &layout._.name));
+
+	/* Vertex array name might have been recycled */
+	if (a__gl_state.vertex_array == layout._.name)
+		a__gl_state.vertex_array = 0;
+
+	a__GLVertexArrayBind(layout._.name);
+	for (unsigned i = 0; i < nattribs; ++i) {
+		const AGLAttribute *a = attribs + i;
+		if (a->_.location < 0)
+			continue;
+
+		a__GLBufferBind(GL_ARRAY_BUFFER, a->buffer->name);
+		AGL__CALL(glEnableVertexAttribArray(a->_.location));
+		AGL__CALL(glVertexAttribPointer(a->_.location, a->size, a->type, a->normalized, a->stride, a->ptr));
+#ifdef GL_VERTEX_ATTRIB_ARRAY_DIVISOR
+		if (a->divisor)
+			AGL__CALL(glVertexAttribDivisor(a->_.location, a->divisor));
+#endif
+	}
+
+	/* Goes into the vertex array object, not into the default one tracked by a__gl_state */
+	AGL__CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer ? index_buffer->name : 0));
+	a__GLVertexArrayBind(0);
+#endif
+
+	return layout;
+}
+
+void aGLVertexLayoutDestroy(AGLVertexLayout *layout) {
+#ifdef GL_VERTEX_ARRAY_BINDING
+	if (layout->_.name) {
+		if (a__gl_state.vertex_array == layout->_.name)
+			a__GLVertexArrayBind(0);
+		AGL__CALL(glDeleteVertexArrays(1, &layout->_.name));
+	}
+#endif
+	layout->_.name = 0;
+}
+
+static void a__GLVertexArrayBind(GLuint name) {
+	if (a__gl_state.vertex_array == name)
+		return;
+
+#ifdef GL_VERTEX_ARRAY_BINDING
+	AGL__CALL(glBindVertexArray(a__gl_state.vertex_array = name));
+	++a__gl_state.stats.vertex_array_binds;
+#endif
+}
+
+static void a__GLVertexLayoutBind(const AGLVertexLayout *layout) {
+	if (layout->_.name) {
+		a__GLVertexArrayBind(layout->_.name);
+		return;
+	}
+
+	a__GLAttribsBind(layout->attribs, layout->nattribs);
+	a__GLBufferBind(GL_ELEMENT_ARRAY_BUFFER, layout->index_buffer ? layout->index_buffer->name : 0);
+}
+
+static const AGLBuffer *a__GLDrawSourceIndexBuffer(const AGLDrawSource *src) {
+	return src->layout ? src->layout->index_buffer : src->primitive.index.buffer;
+}
+
+static int a__GLDrawSourceIsIndexed(const AGLDrawSource *src) {
+	return a__GLDrawSourceIndexBuffer(src) || src->primitive.index.data.ptr;
+}
+
+static uintptr_t a__GLIndexTypeSize(GLenum type) {
+	switch (type) {
+	case GL_UNSIGNED_BYTE: return 1;
+	case GL_UNSIGNED_SHORT: return 2;
+	case GL_UNSIGNED_INT: return 4;
+	}
+	return 0;
+}
+
+static void a__GLStatsDraw(GLenum mode, GLsizei count, GLsizei instances) {
+	GLsizei primitives = 0;
+	switch (mode) {
+	case GL_POINTS: primitives = count; break;
+	case GL_LINES: primitives = count / 2; break;
+	case GL_LINE_LOOP: primitives = count > 1 ? count : 0; break;
+	case GL_LINE_STRIP: primitives = count > 1 ? count - 1 : 0; break;
+	case GL_TRIANGLES: primitives = count / 3; break;
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN: primitives = count > 2 ? count - 2 : 0; break;
+	}
+
+	if (instances < 1)
+		instances = 1;
+	++a__gl_state.stats.draws;
+	a__gl_state.stats.vertices += count * instances;
+	a__gl_state.stats.primitives += primitives * instances;
+}
+
+static void a__GLDrawCall(const AGLDrawSource *src, GLsizei instances) {
+	a__GLStatsDraw(src->primitive.mode, src->primitive.count, instances);
+	++a__gl_state.stats.draw_calls;
+	if (a__GLDrawSourceIsIndexed(src)) {
+#ifdef GL_VERTEX_ATTRIB_ARRAY_DIVISOR
+		if (instances > 1) {
+			AGL__CALL(glDrawElementsInstanced(src->primitive.mode, src->primitive.count, src->primitive.index.type,
+				src->primitive.index.data.ptr, instances));
+			return;
+		}
+#endif
+		AGL__CALL(glDrawElements(
+			src->primitive.mode, src->primitive.count, src->primitive.index.type, src->primitive.index.data.ptr));
+	} else {
+#ifdef GL_VERTEX_ATTRIB_ARRAY_DIVISOR
+		if (instances > 1) {
+			AGL__CALL(glDrawArraysInstanced(src->primitive.mode, src->primitive.first, src->primitive.count, instances));
+			return;
+		}
+#endif
+		AGL__CALL(glDrawArrays(src->primitive.mode, src->primitive.first, src->primitive.count));
+	}
+}
+
+/* One draw per instance, per-instance attributes are fed as constant vertex attributes */
+static void a__GLDrawInstancesEmulated(const AGLDrawSource *src) {
+	const AGLAttribute *attribs = src->layout ? src->layout->attribs : src->attribs.p;
+	const unsigned nattribs = src->layout ? src->layout->nattribs : src->attribs.n;
+
+	for (GLsizei instance = 0; instance < src->primitive.instances; ++instance) {
+		for (unsigned i = 0; i < nattribs; ++i) {
+			const AGLAttribute *a = attribs + i;
+			const GLint loc = a->_.location;
+			if (loc < 0 || !a->divisor)
+				continue;
+
+			ATTO_ASSERT(!a->buffer && a->type == GL_FLOAT);
+			const GLsizei stride = a->stride ? a->stride : a->size * (GLsizei)sizeof(GLfloat);
+			const GLfloat *value = (const GLfloat *)((const char *)a->ptr + (instance / a->divisor) * stride);
+			switch (a->size) {
+			case 1: AGL__CALL(glVertexAttrib1fv(loc, value)); break;
+			case 2: AGL__CALL(glVertexAttrib2fv(loc, value)); break;
+			case 3: AGL__CALL(glVertexAttrib3fv(loc, value)); break;
+			case 4: AGL__CALL(glVertexAttrib4fv(loc, value)); break;
+			default: ATTO_ASSERT(!"Invalid attribute size");
+			}
+		}
+
+		a__GLDrawCall(src, 1);
+	}
+}
+
+static void a__GLDrawBind(const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target) {
 	a__GLTargetBind(target);
 
 	a__GLDepthBind(merge->depth);
 	a__GLBlendBind(&merge->blend);
 
 	a__GLProgramBind(src->program, src->uniforms.p, src->uniforms.n);
-	a__GLAttribsBind(src->attribs.p, src->attribs.n);
+	if (src->layout)
+		a__GLVertexLayoutBind(src->layout);
+	else
+		a__GLAttribsBind(src->attribs.p, src->attribs.n);
 	a__GLCullingBind(src->primitive.cull_mode, src->primitive.front_face);
 
-	if (src->primitive.index.buffer || src->primitive.index.data.ptr) {
-		if (src->primitive.index.buffer) {
-			/* FIXME store binding in state */
-			AGL__CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, src->primitive.index.buffer->name));
-		} else {
-			AGL__CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
-		}
+	if (a__GLDrawSourceIsIndexed(src) && !src->layout)
+		a__GLBufferBind(GL_ELEMENT_ARRAY_BUFFER, src->primitive.index.buffer ? src->primitive.index.buffer->name : 0);
+}
 
-		AGL__CALL(glDrawElements(
-			src->primitive.mode, src->primitive.count, src->primitive.index.type, src->primitive.index.data.ptr));
-	} else
-		AGL__CALL(glDrawArrays(src->primitive.mode, src->primitive.first, src->primitive.count));
+static void a__GLDrawExecute(const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target) {
+	ATTO_GL_PROFILE_PREAMBLE
+	a__GLDrawBind(src, merge, target);
+
+	if (src->primitive.instances > 1 && !a_gl_capabilities.instancing)
+		a__GLDrawInstancesEmulated(src);
+	else
+		a__GLDrawCall(src, src->primitive.instances);
 	ATTO_GL_PROFILE_FUNC("aGLDraw", aAppTime() - start);
 }
 
+static void a__GLCommandBufferRecord(
+	AGLCommandBuffer *buffer, const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target);
+static void a__GLCommandBufferFlush(AGLCommandBuffer *buffer);
+
+void aGLDraw(const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target) {
+	if (a__gl_state.command_buffer) {
+		a__GLCommandBufferRecord(a__gl_state.command_buffer, src, merge, target);
+		return;
+	}
+
+	a__GLDrawExecute(src, merge, target);
+}
+
+#ifdef GL_VERSION_1_4
+static void a__GLMultiDrawCall(const AGLDrawSource *src, const GLint *firsts, const GLsizei *counts, GLsizei n) {
+	for (GLsizei i = 0; i < n; ++i)
+		a__GLStatsDraw(src->primitive.mode, counts[i], 1);
+
+	if (!a__GLDrawSourceIsIndexed(src)) {
+		AGL__CALL(glMultiDrawArrays(src->primitive.mode, firsts, counts, n));
+		++a__gl_state.stats.draw_calls;
+		return;
+	}
+
+	const uintptr_t index_size = a__GLIndexTypeSize(src->primitive.index.type);
+	const void *indices[ATTO_GL_MULTI_DRAW_BATCH];
+	for (GLsizei i = 0; i < n; i += ATTO_GL_MULTI_DRAW_BATCH) {
+		const GLsizei batch = n - i < ATTO_GL_MULTI_DRAW_BATCH ? n - i : ATTO_GL_MULTI_DRAW_BATCH;
+		for (GLsizei j = 0; j < batch; ++j)
+			indices[j] = (const void *)(src->primitive.index.data.offset + index_size * (uintptr_t)firsts[i + j]);
+		AGL__CALL(glMultiDrawElements(src->primitive.mode, counts + i, src->primitive.index.type, indices, batch));
+		++a__gl_state.stats.draw_calls;
+	}
+}
+#endif
+
+void aGLDrawMulti(const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target,
+	const GLint *firsts, const GLsizei *counts, GLsizei n) {
+	ATTO_GL_PROFILE_PREAMBLE
+	const int indexed = a__GLDrawSourceIsIndexed(src);
+	const uintptr_t index_size = a__GLIndexTypeSize(src->primitive.index.type);
+	AGLDrawSource range = *src;
+
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
+	a__GLDrawBind(src, merge, target);
+
+#ifdef GL_VERSION_1_4
+	if (src->primitive.instances <= 1 && a_gl_capabilities.multi_draw) {
+		a__GLMultiDrawCall(src, firsts, counts, n);
+		ATTO_GL_PROFILE_FUNC("aGLDrawMulti", aAppTime() - start);
+		return;
+	}
+#endif
+
+	ATTO_ASSERT(!indexed || index_size);
+	for (GLsizei i = 0; i < n; ++i) {
+		if (indexed)
+			range.primitive.index.data.offset = src->primitive.index.data.offset + index_size * (uintptr_t)firsts[i];
+		else
+			range.primitive.first = firsts[i];
+		range.primitive.count = counts[i];
+
+		if (range.primitive.instances > 1 && !a_gl_capabilities.instancing)
+			a__GLDrawInstancesEmulated(&range);
+		else
+			a__GLDrawCall(&range, range.primitive.instances);
+	}
+	ATTO_GL_PROFILE_FUNC("aGLDrawMulti", aAppTime() - start);
+}
+
+void aGLDrawMultiIndirect(const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target,
+	const AGLBuffer *commands, GLintptr offset, GLsizei n) {
+#ifdef GL_VERSION_4_3
+	ATTO_GL_PROFILE_PREAMBLE
+	ATTO_ASSERT(a_gl_capabilities.multi_draw_indirect);
+
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
+	a__GLDrawBind(src, merge, target);
+	a__GLBufferBind(GL_DRAW_INDIRECT_BUFFER, commands->name);
+
+	/* Vertex counts are only known to the GPU */
+	a__gl_state.stats.draws += n;
+	++a__gl_state.stats.draw_calls;
+
+	if (a__GLDrawSourceIsIndexed(src))
+		AGL__CALL(glMultiDrawElementsIndirect(
+			src->primitive.mode, src->primitive.index.type, (const void *)offset, n, sizeof(AGLDrawElementsIndirect)));
+	else
+		AGL__CALL(glMultiDrawArraysIndirect(src->primitive.mode, (const void *)offset, n, sizeof(AGLDrawArraysIndirect)));
+	ATTO_GL_PROFILE_FUNC("aGLDrawMultiIndirect", aAppTime() - start);
+#else
+	(void)src;
+	(void)merge;
+	(void)target;
+	(void)commands;
+	(void)offset;
+	(void)n;
+	ATTO_ASSERT(!"Multi draw indirect is not supported");
+#endif
+}
+
 void aGLClear(const AGLClearParams *params, const AGLDrawTarget *target) {
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
 	a__GLTargetBind(target);
 
 	AGL__CALL(glClearColor(params->r, params->g, params->b, params->a));
@@ -1151,6 +3187,292 @@ void aGLClear(const AGLClearParams *params, const AGLDrawTarget *target) {
 	AGL__CALL(glClear(params->bits));
 }
 
+AGLStats aGLStatsGet(void) {
+	return a__gl_state.stats;
+}
+
+void aGLStatsReset(void) {
+	memset(&a__gl_state.stats, 0, sizeof(a__gl_state.stats));
+}
+
+#if defined(ATTO_GL_PROFILE_GPU_FUNC) && defined(GL_TIME_ELAPSED)
+static int a__GLGpuTimerReady(void) {
+	if (!a_gl_capabilities.timer_query)
+		return 0;
+
+	/* Queries are created on first use */
+	if (!a__gl_state.gpu_timer.frames[0].queries[0])
+		for (int i = 0; i < ATTO_GL_GPU_TIMER_FRAMES; ++i)
+			AGL__CALL(glGenQueries(ATTO_GL_GPU_TIMER_PASSES, a__gl_state.gpu_timer.frames[i].queries));
+
+	return 1;
+}
+
+void aGLProfilePassBegin(const char *name) {
+	if (!a__GLGpuTimerReady())
+		return;
+
+	ATTO_ASSERT(!a__gl_state.gpu_timer.running);
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
+	const int frame = a__gl_state.gpu_timer.frame;
+	const int pass = a__gl_state.gpu_timer.frames[frame].count;
+	if (pass == ATTO_GL_GPU_TIMER_PASSES)
+		return;
+
+	a__gl_state.gpu_timer.frames[frame].names[pass] = name;
+	AGL__CALL(glBeginQuery(GL_TIME_ELAPSED, a__gl_state.gpu_timer.frames[frame].queries[pass]));
+	a__gl_state.gpu_timer.running = 1;
+}
+
+void aGLProfilePassEnd(void) {
+	if (!a__gl_state.gpu_timer.running)
+		return;
+
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
+	AGL__CALL(glEndQuery(GL_TIME_ELAPSED));
+	++a__gl_state.gpu_timer.frames[a__gl_state.gpu_timer.frame].count;
+	a__gl_state.gpu_timer.running = 0;
+}
+
+void aGLProfileFrame(void) {
+	if (!a__GLGpuTimerReady())
+		return;
+
+	ATTO_ASSERT(!a__gl_state.gpu_timer.running);
+	a__gl_state.gpu_timer.frame = (a__gl_state.gpu_timer.frame + 1) % ATTO_GL_GPU_TIMER_FRAMES;
+
+	/* Oldest frame is about to be reused, report what has finished */
+	const int frame = a__gl_state.gpu_timer.frame;
+	for (int i = 0; i < a__gl_state.gpu_timer.frames[frame].count; ++i) {
+		const GLuint query = a__gl_state.gpu_timer.frames[frame].queries[i];
+		GLint available = 0;
+		GLuint64 elapsed = 0;
+		AGL__CALL(glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+		if (!available)
+			break;
+
+		AGL__CALL(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed));
+		ATTO_GL_PROFILE_GPU_FUNC(a__gl_state.gpu_timer.frames[frame].names[i], (ATimeUs)(elapsed / 1000));
+	}
+	a__gl_state.gpu_timer.frames[frame].count = 0;
+}
+#else
+void aGLProfilePassBegin(const char *name) {
+	(void)name;
+}
+void aGLProfilePassEnd(void) {
+}
+void aGLProfileFrame(void) {
+}
+#endif
+
+/* Only opaque draws that write depth with a strict test resolve overlaps the same way in
+ * any order */
+static int a__GLDrawIsOrderDependent(const AGLDrawMerge *merge) {
+	return merge->blend.enable || merge->depth.mode != AGLDM_TestAndWrite ||
+		(merge->depth.func != AGLDF_Less && merge->depth.func != AGLDF_Greater);
+}
+
+static int a__GLDrawTargetEqual(const AGLDrawTarget *a, const AGLDrawTarget *b) {
+	const GLuint afb = a->framebuffer ? a->framebuffer->name : 0;
+	const GLuint bfb = b->framebuffer ? b->framebuffer->name : 0;
+	return afb == bfb && a->viewport.x == b->viewport.x && a->viewport.y == b->viewport.y &&
+		a->viewport.w == b->viewport.w && a->viewport.h == b->viewport.h;
+}
+
+static int a__GLDrawMergeEqual(const AGLDrawMerge *a, const AGLDrawMerge *b) {
+	if (a->depth.mode != b->depth.mode || a->depth.func != b->depth.func || a->blend.enable != b->blend.enable)
+		return 0;
+
+	if (!a->blend.enable)
+		return 1;
+
+	return a->blend.color.r == b->blend.color.r && a->blend.color.g == b->blend.color.g &&
+		a->blend.color.b == b->blend.color.b && a->blend.color.a == b->blend.color.a &&
+		a->blend.equation.rgb == b->blend.equation.rgb && a->blend.equation.a == b->blend.equation.a &&
+		a->blend.func.src_rgb == b->blend.func.src_rgb && a->blend.func.src_a == b->blend.func.src_a &&
+		a->blend.func.dst_rgb == b->blend.func.dst_rgb && a->blend.func.dst_a == b->blend.func.dst_a;
+}
+
+static int a__GLUniformEqual(const AGLProgramUniform *a, const AGLProgramUniform *b) {
+	if (a->_.location != b->_.location || a->type != b->type || a->count != b->count)
+		return 0;
+
+	switch (a->type) {
+	case AGLAT_Texture: return a->value.texture == b->value.texture && a->sampler == b->sampler;
+	case AGLAT_Int:
+	case AGLAT_IVec2:
+	case AGLAT_IVec3:
+	case AGLAT_IVec4: return a->value.pi == b->value.pi;
+	default: return a->value.pf == b->value.pf;
+	}
+}
+
+static int a__GLAttribEqual(const AGLAttribute *a, const AGLAttribute *b) {
+	const GLuint abuf = a->buffer ? a->buffer->name : 0;
+	const GLuint bbuf = b->buffer ? b->buffer->name : 0;
+	return abuf == bbuf && a->_.location == b->_.location && a->size == b->size && a->type == b->type &&
+		a->normalized == b->normalized && a->stride == b->stride && a->ptr == b->ptr && a->divisor == b->divisor;
+}
+
+/* Everything but the primitive range */
+static int a__GLDrawCommandStateEqual(const AGLDrawCommand *a, const AGLDrawCommand *b) {
+	const AGLDrawSource *as = &a->source, *bs = &b->source;
+	unsigned i;
+
+	if (as->program != bs->program || as->uniforms.n != bs->uniforms.n || as->attribs.n != bs->attribs.n ||
+		as->layout != bs->layout)
+		return 0;
+
+	if (as->primitive.mode != bs->primitive.mode || as->primitive.cull_mode != bs->primitive.cull_mode ||
+		as->primitive.front_face != bs->primitive.front_face ||
+		a__GLDrawSourceIsIndexed(as) != a__GLDrawSourceIsIndexed(bs) ||
+		a__GLDrawSourceIndexBuffer(as) != a__GLDrawSourceIndexBuffer(bs) ||
+		as->primitive.index.type != bs->primitive.index.type)
+		return 0;
+
+	if (!a__GLDrawMergeEqual(&a->merge, &b->merge) || !a__GLDrawTargetEqual(&a->target, &b->target))
+		return 0;
+
+	for (i = 0; i < as->uniforms.n; ++i)
+		if (!a__GLUniformEqual(as->uniforms.p + i, bs->uniforms.p + i))
+			return 0;
+
+	if (as->attribs.p != bs->attribs.p)
+		for (i = 0; i < as->attribs.n; ++i)
+			if (!a__GLAttribEqual(as->attribs.p + i, bs->attribs.p + i))
+				return 0;
+
+	return 1;
+}
+
+/* Whether b continues a so that both can be drawn with a single call */
+static int a__GLDrawRangesContiguous(const AGLDrawSource *a, const AGLDrawSource *b) {
+	uintptr_t index_size = 0;
+
+	if (a->primitive.instances > 1 || b->primitive.instances > 1)
+		return 0;
+
+	switch (a->primitive.mode) {
+	case GL_POINTS:
+	case GL_LINES:
+	case GL_TRIANGLES: break;
+	default: return 0;
+	}
+
+	if (!a__GLDrawSourceIsIndexed(a))
+		return a->primitive.first + a->primitive.count == b->primitive.first;
+
+	index_size = a__GLIndexTypeSize(a->primitive.index.type);
+	if (!index_size)
+		return 0;
+
+	return a->primitive.index.data.offset + index_size * (uintptr_t)a->primitive.count == b->primitive.index.data.offset;
+}
+
+/* | segment:24 | program:16 | textures:16 | depth:8 |
+ * Segment changes with target and around order-dependent draws, so that sorting never moves
+ * a draw across a target switch, a blended or a depth-less draw */
+static uint64_t a__GLDrawCommandKey(const AGLDrawCommand *cmd, unsigned segment) {
+	const AGLDrawSource *src = &cmd->source;
+	uint32_t textures = 0;
+	unsigned i;
+
+	for (i = 0; i < src->uniforms.n; ++i)
+		if (src->uniforms.p[i].type == AGLAT_Texture && src->uniforms.p[i].value.texture)
+			textures = textures * 31 + src->uniforms.p[i].value.texture->_.name;
+
+	return ((uint64_t)(segment & 0xffffffu) << 40) | ((uint64_t)(src->program & 0xffff) << 24) |
+		((uint64_t)(textures & 0xffffu) << 8) | ((unsigned)cmd->merge.depth.mode << 4) |
+		((unsigned)(cmd->merge.depth.func - GL_NEVER) & 0x0fu);
+}
+
+static int a__GLDrawCommandCompare(const void *a, const void *b) {
+	const AGLDrawCommand *ca = (const AGLDrawCommand *)a, *cb = (const AGLDrawCommand *)b;
+	if (ca->key != cb->key)
+		return ca->key < cb->key ? -1 : 1;
+	return ca->sequence < cb->sequence ? -1 : (ca->sequence > cb->sequence);
+}
+
+static void a__GLCommandBufferRecord(
+	AGLCommandBuffer *buffer, const AGLDrawSource *src, const AGLDrawMerge *merge, const AGLDrawTarget *target) {
+	AGLDrawCommand *cmd;
+
+	ATTO_ASSERT(src->uniforms.n <= buffer->uniforms_capacity);
+	if (buffer->_.commands == buffer->commands_capacity ||
+		buffer->_.uniforms + src->uniforms.n > buffer->uniforms_capacity)
+		a__GLCommandBufferFlush(buffer);
+
+	cmd = buffer->commands + buffer->_.commands;
+	cmd->source = *src;
+	cmd->merge = *merge;
+	cmd->target = *target;
+	cmd->sequence = buffer->_.commands;
+
+	if (src->uniforms.n) {
+		AGLProgramUniform *const uniforms = buffer->uniforms + buffer->_.uniforms;
+		memcpy(uniforms, src->uniforms.p, sizeof(*uniforms) * src->uniforms.n);
+		cmd->source.uniforms.p = uniforms;
+		buffer->_.uniforms += src->uniforms.n;
+	}
+
+	if (buffer->_.commands > 0) {
+		const AGLDrawCommand *prev = cmd - 1;
+		if (!a__GLDrawTargetEqual(&prev->target, target) ||
+			((a__GLDrawIsOrderDependent(&prev->merge) || a__GLDrawIsOrderDependent(merge)) &&
+				!a__GLDrawCommandStateEqual(prev, cmd)))
+			++buffer->_.segment;
+	}
+
+	cmd->key = a__GLDrawCommandKey(cmd, buffer->_.segment);
+	++buffer->_.commands;
+}
+
+static void a__GLCommandBufferFlush(AGLCommandBuffer *buffer) {
+	AGLDrawCommand pending;
+	unsigned i;
+
+	if (!buffer->_.commands)
+		return;
+
+	qsort(buffer->commands, buffer->_.commands, sizeof(*buffer->commands), a__GLDrawCommandCompare);
+
+	pending = buffer->commands[0];
+	for (i = 1; i < buffer->_.commands; ++i) {
+		const AGLDrawCommand *cmd = buffer->commands + i;
+		if (pending.key == cmd->key && a__GLDrawCommandStateEqual(&pending, cmd) &&
+			a__GLDrawRangesContiguous(&pending.source, &cmd->source)) {
+			pending.source.primitive.count += cmd->source.primitive.count;
+			continue;
+		}
+
+		a__GLDrawExecute(&pending.source, &pending.merge, &pending.target);
+		pending = *cmd;
+	}
+	a__GLDrawExecute(&pending.source, &pending.merge, &pending.target);
+
+	buffer->_.commands = buffer->_.uniforms = buffer->_.segment = 0;
+}
+
+void aGLCommandBufferBegin(AGLCommandBuffer *buffer) {
+	ATTO_ASSERT(!a__gl_state.command_buffer);
+	ATTO_ASSERT(buffer->commands && buffer->commands_capacity > 0);
+
+	buffer->_.commands = buffer->_.uniforms = buffer->_.segment = 0;
+	a__gl_state.command_buffer = buffer;
+}
+
+void aGLCommandBufferSubmit(AGLCommandBuffer *buffer) {
+	ATTO_ASSERT(a__gl_state.command_buffer == buffer);
+
+	a__gl_state.command_buffer = NULL;
+	a__GLCommandBufferFlush(buffer);
+}
+
 static GLuint a__GLCreateShader(int type, const char *const *source) {
 	int n;
 	GLuint shader = glCreateShader(type);
@@ -1160,45 +3482,115 @@ static GLuint a__GLCreateShader(int type, const char *const *source) {
 
 	AGL__CALL(glShaderSource(shader, n, (const GLchar **)source, 0));
 	AGL__CALL(glCompileShader(shader));
+	return shader;
+}
 
-	{
-		GLint status;
-		AGL__CALL(glGetShaderiv(shader, GL_COMPILE_STATUS, &status));
-		if (status != GL_TRUE) {
-			AGL__CALL(glGetShaderInfoLog(shader, sizeof(a_gl_error), 0, a_gl_error));
-			AGL__CALL(glDeleteShader(shader));
-			shader = 0;
+static size_t a__GLUniformComponents(AGLAttributeType type) {
+	switch (type) {
+	case AGLAT_Float:
+	case AGLAT_Int:
+	case AGLAT_Texture: return 1;
+	case AGLAT_Vec2:
+	case AGLAT_IVec2: return 2;
+	case AGLAT_Vec3:
+	case AGLAT_IVec3: return 3;
+	case AGLAT_Vec4:
+	case AGLAT_IVec4:
+	case AGLAT_Mat2: return 4;
+	case AGLAT_Mat3: return 9;
+	case AGLAT_Mat4: return 16;
+	}
+	return 0;
+}
+
+static struct A__GLUniformShadow *a__GLUniformShadowFind(AGLProgram program, GLint loc) {
+	return a__gl_state.uniforms + ((unsigned)program * 31u + (unsigned)loc) % ATTO_GL_UNIFORM_CACHE_SIZE;
+}
+
+/* Returns non-zero if value differs from the one program is known to hold, and remembers it.
+ * Arrays are not remembered, their elements have locations of their own that can be
+ * uploaded separately, so entries of all the elements are forgotten instead */
+static int a__GLUniformShouldUpload(AGLProgram program, const AGLProgramUniform *uniform, const void *value) {
+	const GLint loc = uniform->_.location;
+	const size_t size = (uniform->type == AGLAT_Texture)
+		? sizeof(GLint)
+		: a__GLUniformComponents(uniform->type) * uniform->count * sizeof(GLfloat);
+	struct A__GLUniformShadow *shadow = a__GLUniformShadowFind(program, loc);
+	const int hit = shadow->program == program && shadow->location == loc;
+
+	if (uniform->count > 1) {
+		for (GLint i = 0; i < uniform->count; ++i) {
+			struct A__GLUniformShadow *element = a__GLUniformShadowFind(program, loc + i);
+			if (element->program == program && element->location == loc + i)
+				element->program = 0;
 		}
+	} else if ((uniform->flags & AGLPUF_AlwaysDirty) || size > sizeof(shadow->value)) {
+		if (hit)
+			shadow->program = 0;
+	} else if (hit && shadow->size == size && memcmp(shadow->value, value, size) == 0) {
+		++a__gl_state.stats.uniform_uploads_skipped;
+		return 0;
+	} else {
+		shadow->program = program;
+		shadow->location = loc;
+		shadow->size = size;
+		memcpy(shadow->value, value, size);
 	}
 
-	return shader;
+	++a__gl_state.stats.uniform_uploads;
+	return 1;
 }
 
 void a__GLProgramBind(AGLProgram program, const AGLProgramUniform *uniforms, int nuniforms) {
 	ATTO_GL_PROFILE_START
 	int i, texture_unit = 0;
-	AGL__CALL(glUseProgram(program));
+	if (a__gl_state.program != program) {
+		AGL__CALL(glUseProgram(a__gl_state.program = program));
+		++a__gl_state.stats.program_binds;
+	}
 	for (i = 0; i < nuniforms; ++i) {
 		ATTO_GL_PROFILE_START
-		const int loc = uniforms[i]._.location;
-		if (loc == -1) { /*AGL_PRINTFLN("Skipping %s", uniforms[i].name);*/
+		const AGLProgramUniform *u = uniforms + i;
+		const int loc = u->_.location;
+		if (loc == -1) { /*AGL_PRINTFLN("Skipping %s", u->name);*/
 			continue;
 		}
-		switch (uniforms[i].type) {
-		case AGLAT_Float: AGL__CALL(glUniform1fv(loc, uniforms[i].count, uniforms[i].value.pf)); break;
-		case AGLAT_Vec2: AGL__CALL(glUniform2fv(loc, uniforms[i].count, uniforms[i].value.pf)); break;
-		case AGLAT_Vec3: AGL__CALL(glUniform3fv(loc, uniforms[i].count, uniforms[i].value.pf)); break;
-		case AGLAT_Vec4: AGL__CALL(glUniform4fv(loc, uniforms[i].count, uniforms[i].value.pf)); break;
-		case AGLAT_Mat2: AGL__CALL(glUniformMatrix2fv(loc, uniforms[i].count, GL_FALSE, uniforms[i].value.pf)); break;
-		case AGLAT_Mat3: AGL__CALL(glUniformMatrix3fv(loc, uniforms[i].count, GL_FALSE, uniforms[i].value.pf)); break;
-		case AGLAT_Mat4: AGL__CALL(glUniformMatrix4fv(loc, uniforms[i].count, GL_FALSE, uniforms[i].value.pf)); break;
-		case AGLAT_Int: AGL__CALL(glUniform1iv(loc, uniforms[i].count, uniforms[i].value.pi)); break;
-		case AGLAT_IVec2: AGL__CALL(glUniform2iv(loc, uniforms[i].count, uniforms[i].value.pi)); break;
-		case AGLAT_IVec3: AGL__CALL(glUniform3iv(loc, uniforms[i].count, uniforms[i].value.pi)); break;
-		case AGLAT_IVec4: AGL__CALL(glUniform4iv(loc, uniforms[i].count, uniforms[i].value.pi)); break;
+		switch (u->type) {
+		case AGLAT_Float:
+		case AGLAT_Vec2:
+		case AGLAT_Vec3:
+		case AGLAT_Vec4:
+		case AGLAT_Mat2:
+		case AGLAT_Mat3:
+		case AGLAT_Mat4:
+			if (!a__GLUniformShouldUpload(program, u, u->value.pf))
+				continue;
+			break;
+		case AGLAT_Int:
+		case AGLAT_IVec2:
+		case AGLAT_IVec3:
+		case AGLAT_IVec4:
+			if (!a__GLUniformShouldUpload(program, u, u->value.pi))
+				continue;
+			break;
+		case AGLAT_Texture: break;
+		}
+		switch (u->type) {
+		case AGLAT_Float: AGL__CALL(glUniform1fv(loc, u->count, u->value.pf)); break;
+		case AGLAT_Vec2: AGL__CALL(glUniform2fv(loc, u->count, u->value.pf)); break;
+		case AGLAT_Vec3: AGL__CALL(glUniform3fv(loc, u->count, u->value.pf)); break;
+		case AGLAT_Vec4: AGL__CALL(glUniform4fv(loc, u->count, u->value.pf)); break;
+		case AGLAT_Mat2: AGL__CALL(glUniformMatrix2fv(loc, u->count, GL_FALSE, u->value.pf)); break;
+		case AGLAT_Mat3: AGL__CALL(glUniformMatrix3fv(loc, u->count, GL_FALSE, u->value.pf)); break;
+		case AGLAT_Mat4: AGL__CALL(glUniformMatrix4fv(loc, u->count, GL_FALSE, u->value.pf)); break;
+		case AGLAT_Int: AGL__CALL(glUniform1iv(loc, u->count, u->value.pi)); break;
+		case AGLAT_IVec2: AGL__CALL(glUniform2iv(loc, u->count, u->value.pi)); break;
+		case AGLAT_IVec3: AGL__CALL(glUniform3iv(loc, u->count, u->value.pi)); break;
+		case AGLAT_IVec4: AGL__CALL(glUniform4iv(loc, u->count, u->value.pi)); break;
 		case AGLAT_Texture:
-			a__GLTextureBind(uniforms[i].value.texture, texture_unit);
-			AGL__CALL(glUniform1i(loc, texture_unit));
+			a__GLTextureBind(u->value.texture, u->sampler, texture_unit);
+			if (a__GLUniformShouldUpload(program, u, &texture_unit))
+				AGL__CALL(glUniform1i(loc, texture_unit));
 			++texture_unit;
 		}
 		ATTO_GL_PROFILE_END_NAME("per uniform")
@@ -1208,7 +3600,19 @@ void a__GLProgramBind(AGLProgram program, const AGLProgramUniform *uniforms, int
 
 static void a__GLTargetBind(const AGLDrawTarget *target) {
 	ATTO_GL_PROFILE_PREAMBLE
+	const GLuint name = target->framebuffer ? target->framebuffer->name : 0;
+	if (a__gl_state.framebuffer.discard_depth && a__gl_state.framebuffer.target != name) {
+		const GLenum depth = a__gl_state.framebuffer.target ? GL_DEPTH_ATTACHMENT : A__GL_DEFAULT_DEPTH;
+		/* Readbacks and resolves might have bound something else since */
+		if (a__gl_state.framebuffer.binding != a__gl_state.framebuffer.target) {
+			AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, a__gl_state.framebuffer.binding = a__gl_state.framebuffer.target));
+			++a__gl_state.stats.framebuffer_binds;
+		}
+		a__GLFramebufferInvalidate(1, &depth);
+	}
 	a__GLFramebufferBind(target->framebuffer);
+	a__gl_state.framebuffer.target = name;
+	a__gl_state.framebuffer.discard_depth = target->discard_depth;
 
 	if (target->viewport.x != a__gl_state.viewport.x || target->viewport.y != a__gl_state.viewport.y ||
 		target->viewport.w != a__gl_state.viewport.w || target->viewport.h != a__gl_state.viewport.h) {
@@ -1222,34 +3626,179 @@ static void a__GLTargetBind(const AGLDrawTarget *target) {
 	ATTO_GL_PROFILE_FUNC(__FUNCTION__, aAppTime() - start);
 }
 
-static void a__GLTextureBind(const AGLTexture *texture, GLint unit) {
-	ATTO_GL_PROFILE_START
-	AGL__CALL(glActiveTexture(GL_TEXTURE0 + unit));
-	AGL__CALL(glBindTexture(GL_TEXTURE_2D, texture->_.name));
-
-	AGLTexture *mutable_texture = (AGLTexture *)texture;
-	if (mutable_texture->_.min_filter != (GLenum)mutable_texture->min_filter) {
-		AGL__CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mutable_texture->min_filter));
-		mutable_texture->_.min_filter = (GLenum)mutable_texture->min_filter;
+static GLenum a__GLTextureTarget(AGLTextureType type) {
+	switch (type) {
+	case AGLTT_1D: return GL_TEXTURE_1D;
+	case AGLTT_2D: return GL_TEXTURE_2D;
+	case AGLTT_3D: return GL_TEXTURE_3D;
+	case AGLTT_2DArray: return GL_TEXTURE_2D_ARRAY;
+	case AGLTT_NULL: ATTO_ASSERT(!"Invalid texture type");
 	}
-	if (mutable_texture->_.mag_filter != (GLenum)mutable_texture->mag_filter) {
-		AGL__CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mutable_texture->mag_filter));
-		mutable_texture->_.mag_filter = (GLenum)mutable_texture->mag_filter;
+	return 0;
+}
+
+static void a__GLTextureActivate(GLint unit) {
+	if (a__gl_state.textures.active != unit)
+		AGL__CALL(glActiveTexture(GL_TEXTURE0 + (a__gl_state.textures.active = unit)));
+}
+
+static void a__GLTextureUnitBind(GLint unit, AGLTextureType type, GLuint name) {
+	ATTO_ASSERT(unit >= 0 && unit < ATTO_GL_MAX_TEXTURE_UNITS);
+	ATTO_ASSERT(type > AGLTT_NULL && type <= AGLTT_2DArray);
+
+	if (a__gl_state.textures.bound[unit][type] == name)
+		return;
+
+	a__GLTextureActivate(unit);
+	AGL__CALL(glBindTexture(a__GLTextureTarget(type), name));
+	a__gl_state.textures.bound[unit][type] = name;
+	++a__gl_state.stats.texture_binds;
+}
+
+static void a__GLSamplerUnitBind(GLint unit, GLuint name) {
+#ifdef GL_SAMPLER_BINDING
+	if (a__gl_state.textures.samplers[unit] == name)
+		return;
+
+	AGL__CALL(glBindSampler((GLuint)unit, a__gl_state.textures.samplers[unit] = name));
+	++a__gl_state.stats.sampler_binds;
+#else
+	(void)unit;
+	(void)name;
+#endif
+}
+
+/* Sets one parameter if it differs from the applied one, on the sampler object if there is
+ * one, otherwise on the texture bound to unit */
+static void a__GLSamplingParameter(GLint unit, GLenum target, GLuint sampler, GLenum pname, GLenum value, GLenum *applied) {
+	if (*applied == value)
+		return;
+	*applied = value;
+
+#ifdef GL_SAMPLER_BINDING
+	if (sampler) {
+		AGL__CALL(glSamplerParameteri(sampler, pname, (GLint)value));
+		return;
 	}
-	if (mutable_texture->_.wrap_s != (GLenum)mutable_texture->wrap_s) {
-		AGL__CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, mutable_texture->wrap_s));
-		mutable_texture->_.wrap_s = (GLenum)mutable_texture->wrap_s;
+#else
+	(void)sampler;
+#endif
+	a__GLTextureActivate(unit);
+	AGL__CALL(glTexParameteri(target, pname, (GLint)value));
+}
+
+/* Brings parameters applied to a sampler object, or to the texture bound to unit with
+ * sampler 0, in line with desired */
+static void a__GLSamplingUpdate(GLint unit, GLenum target, GLuint sampler, const AGLSampler *desired,
+	GLenum *applied_min_filter, GLenum *applied_mag_filter, GLenum *applied_wrap_s, GLenum *applied_wrap_t,
+	GLenum *applied_wrap_r, GLfloat *applied_anisotropy) {
+	a__GLSamplingParameter(unit, target, sampler, GL_TEXTURE_MIN_FILTER, desired->min_filter, applied_min_filter);
+	a__GLSamplingParameter(unit, target, sampler, GL_TEXTURE_MAG_FILTER, desired->mag_filter, applied_mag_filter);
+	a__GLSamplingParameter(unit, target, sampler, GL_TEXTURE_WRAP_S, desired->wrap_s, applied_wrap_s);
+	a__GLSamplingParameter(unit, target, sampler, GL_TEXTURE_WRAP_T, desired->wrap_t, applied_wrap_t);
+#ifdef GL_TEXTURE_WRAP_R
+	/* Only 3D textures are sampled with it */
+	if (sampler || target == GL_TEXTURE_3D)
+		a__GLSamplingParameter(unit, target, sampler, GL_TEXTURE_WRAP_R, desired->wrap_r, applied_wrap_r);
+#else
+	(void)applied_wrap_r;
+#endif
+
+#ifdef GL_TEXTURE_MAX_ANISOTROPY_EXT
+	{
+		const GLfloat limit = a_gl_capabilities.max_anisotropy;
+		const GLfloat anisotropy = desired->max_anisotropy < 1.f ? 1.f
+			: desired->max_anisotropy > limit ? limit : desired->max_anisotropy;
+		if (limit > 1.f && *applied_anisotropy != anisotropy) {
+			*applied_anisotropy = anisotropy;
+#ifdef GL_SAMPLER_BINDING
+			if (sampler) {
+				AGL__CALL(glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy));
+				return;
+			}
+#endif
+			a__GLTextureActivate(unit);
+			AGL__CALL(glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy));
+		}
 	}
-	if (mutable_texture->_.wrap_t != (GLenum)mutable_texture->wrap_t) {
-		AGL__CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, mutable_texture->wrap_t));
-		mutable_texture->_.wrap_t = (GLenum)mutable_texture->wrap_t;
+#else
+	(void)applied_anisotropy;
+#endif
+}
+
+static void a__GLTextureBind(const AGLTexture *texture, const AGLSampler *sampler, GLint unit) {
+	ATTO_GL_PROFILE_START
+	const GLenum target = a__GLTextureTarget(texture->type);
+	a__GLTextureUnitBind(unit, texture->type, texture->_.name);
+
+	if (sampler && sampler->_.name) {
+		AGLSampler *mutable_sampler = (AGLSampler *)sampler;
+		a__GLSamplingUpdate(unit, target, sampler->_.name, sampler, &mutable_sampler->_.min_filter,
+			&mutable_sampler->_.mag_filter, &mutable_sampler->_.wrap_s, &mutable_sampler->_.wrap_t,
+			&mutable_sampler->_.wrap_r, &mutable_sampler->_.max_anisotropy);
+		a__GLSamplerUnitBind(unit, sampler->_.name);
+	} else {
+		/* Emulated samplers are applied to the texture itself */
+		AGLTexture *mutable_texture = (AGLTexture *)texture;
+		const AGLSampler own = {
+			.min_filter = texture->min_filter,
+			.mag_filter = texture->mag_filter,
+			.wrap_s = texture->wrap_s,
+			.wrap_t = texture->wrap_t,
+			.wrap_r = texture->wrap_r,
+			.max_anisotropy = texture->max_anisotropy,
+		};
+		if (a_gl_capabilities.sampler_objects)
+			a__GLSamplerUnitBind(unit, 0);
+		a__GLSamplingUpdate(unit, target, 0, sampler ? sampler : &own, &mutable_texture->_.min_filter,
+			&mutable_texture->_.mag_filter, &mutable_texture->_.wrap_s, &mutable_texture->_.wrap_t,
+			&mutable_texture->_.wrap_r, &mutable_texture->_.max_anisotropy);
 	}
 	ATTO_GL_PROFILE_END
 }
 
+AGLSampler aGLSamplerCreate(void) {
+	AGLSampler sampler = {
+		.min_filter = AGLTmF_Linear,
+		.mag_filter = AGLTMF_Linear,
+		.wrap_s = AGLTW_Repeat,
+		.wrap_t = AGLTW_Repeat,
+		.wrap_r = AGLTW_Repeat,
+		.max_anisotropy = 1.f,
+		._ = {
+			.min_filter = (GLenum)-1,
+			.mag_filter = (GLenum)-1,
+			.wrap_s = (GLenum)-1,
+			.wrap_t = (GLenum)-1,
+			.wrap_r = (GLenum)-1,
+			.max_anisotropy = 1.f,
+		},
+	};
+
+#ifdef GL_SAMPLER_BINDING
+	if (a_gl_capabilities.sampler_objects)
+		AGL__CALL(glGenSamplers(1, &sampler._.name));
+#endif
+	return sampler;
+}
+
+void aGLSamplerDestroy(AGLSampler *sampler) {
+#ifdef GL_SAMPLER_BINDING
+	if (sampler->_.name) {
+		/* Deleting unbinds it from all units */
+		for (int i = 0; i < ATTO_GL_MAX_TEXTURE_UNITS; ++i)
+			if (a__gl_state.textures.samplers[i] == sampler->_.name)
+				a__gl_state.textures.samplers[i] = 0;
+		AGL__CALL(glDeleteSamplers(1, &sampler->_.name));
+	}
+#endif
+	sampler->_.name = 0;
+}
+
 static void a__GLAttribsBind(const AGLAttribute *attribs, int nattribs) {
 	ATTO_GL_PROFILE_START
 	int i;
+	a__GLVertexArrayBind(0);
 	++a__gl_state.attribs_serial;
 	for (i = 0; i < nattribs; ++i) {
 		const AGLAttribute *a = attribs + i;
@@ -1261,20 +3810,28 @@ static void a__GLAttribsBind(const AGLAttribute *attribs, int nattribs) {
 		if (loc >= ATTO_GL_MAX_ATTRIBS) {
 			ATTO_ASSERT("Attrib location is too large");
 		}
+		if (a->divisor && !a_gl_capabilities.instancing) {
+			/* Left disabled, emulated instancing sets it for each instance */
+			continue;
+		}
 		if (a__gl_state.attribs[loc].buffer < 0)
 			AGL__CALL(glEnableVertexAttribArray(loc));
-		if (a__gl_state.attribs[loc].buffer != buffer) {
-			AGL__CALL(glBindBuffer(GL_ARRAY_BUFFER, buffer));
-			a__gl_state.attribs[loc].buffer = buffer;
-		}
 
 		a__gl_state.attribs[loc].serial = a__gl_state.attribs_serial;
-		if (a__gl_state.attribs[loc].attrib.size != a->size || a__gl_state.attribs[loc].attrib.type != a->type ||
+		/* Array buffer binding is captured by glVertexAttribPointer, so both change together */
+		if (a__gl_state.attribs[loc].buffer != buffer || a__gl_state.attribs[loc].attrib.size != a->size ||
+			a__gl_state.attribs[loc].attrib.type != a->type ||
 			a__gl_state.attribs[loc].attrib.normalized != a->normalized ||
 			a__gl_state.attribs[loc].attrib.stride != a->stride || a__gl_state.attribs[loc].attrib.ptr != a->ptr) {
+			a__GLBufferBind(GL_ARRAY_BUFFER, buffer);
 			AGL__CALL(glVertexAttribPointer(loc, a->size, a->type, a->normalized, a->stride, a->ptr));
-			a__gl_state.attribs[loc].attrib = *a;
+			a__gl_state.attribs[loc].buffer = buffer;
 		}
+#ifdef GL_VERTEX_ATTRIB_ARRAY_DIVISOR
+		if (a__gl_state.attribs[loc].attrib.divisor != a->divisor)
+			AGL__CALL(glVertexAttribDivisor(loc, a->divisor));
+#endif
+		a__gl_state.attribs[loc].attrib = *a;
 	}
 
 	for (i = 0; i < ATTO_GL_MAX_ATTRIBS; ++i) {
@@ -1289,6 +3846,7 @@ static void a__GLAttribsBind(const AGLAttribute *attribs, int nattribs) {
 static void a__GLDepthBind(AGLDepthParams depth) {
 	AGLDepthParams *cur = &a__gl_state.depth;
 	if (depth.mode != cur->mode) {
+		++a__gl_state.stats.depth_changes;
 		if (depth.mode == AGLDM_Disabled) {
 			AGL__CALL(glDisable(GL_DEPTH_TEST));
 		} else {
@@ -1301,13 +3859,16 @@ static void a__GLDepthBind(AGLDepthParams depth) {
 	if (cur->mode == AGLDM_Disabled)
 		return;
 
-	if (depth.func != cur->func)
+	if (depth.func != cur->func) {
 		AGL__CALL(glDepthFunc(cur->func = depth.func));
+		++a__gl_state.stats.depth_changes;
+	}
 }
 
 static void a__GLBlendBind(const AGLBlendParams *blend) {
 	AGLBlendParams *cur = &a__gl_state.blend;
 	if (blend->enable != cur->enable) {
+		++a__gl_state.stats.blend_changes;
 		cur->enable = blend->enable;
 		if (!blend->enable)
 			AGL__CALL(glDisable(GL_BLEND));
@@ -1321,11 +3882,13 @@ static void a__GLBlendBind(const AGLBlendParams *blend) {
 	if (blend->color.r != cur->color.r || blend->color.g != cur->color.g || blend->color.b != cur->color.b ||
 		blend->color.a != cur->color.a) {
 		cur->color = blend->color;
+		++a__gl_state.stats.blend_changes;
 		AGL__CALL(glBlendColor(cur->color.r, cur->color.g, cur->color.b, cur->color.a));
 	}
 
 	if (blend->equation.rgb != cur->equation.rgb || blend->equation.a != cur->equation.a) {
 		cur->equation = blend->equation;
+		++a__gl_state.stats.blend_changes;
 		if (cur->equation.rgb == cur->equation.a)
 			AGL__CALL(glBlendEquation(cur->equation.rgb));
 		else
@@ -1335,6 +3898,7 @@ static void a__GLBlendBind(const AGLBlendParams *blend) {
 	if (blend->func.src_rgb != cur->func.src_rgb || blend->func.dst_rgb != cur->func.dst_rgb ||
 		blend->func.src_a != cur->func.src_a || blend->func.dst_a != cur->func.dst_a) {
 		cur->func = blend->func;
+		++a__gl_state.stats.blend_changes;
 		if (cur->func.src_rgb == cur->func.src_a && cur->func.dst_rgb == cur->func.dst_a)
 			AGL__CALL(glBlendFunc(cur->func.src_rgb, cur->func.dst_rgb));
 		else
@@ -1344,64 +3908,172 @@ static void a__GLBlendBind(const AGLBlendParams *blend) {
 
 static void a__GLCullingBind(AGLCullMode cull, AGLFrontFace front) {
 	if (cull != a__gl_state.cull_mode) {
+		++a__gl_state.stats.cull_changes;
 		if (cull == AGLCM_Disable) {
 			AGL__CALL(glDisable(GL_CULL_FACE));
-			return;
-		}
-
-		if (a__gl_state.cull_mode == AGLCM_Disable) {
-			AGL__CALL(glEnable(GL_CULL_FACE));
-			return;
+		} else {
+			if (a__gl_state.cull_mode == AGLCM_Disable)
+				AGL__CALL(glEnable(GL_CULL_FACE));
+			AGL__CALL(glCullFace(cull));
 		}
-
-		AGL__CALL(glCullFace(a__gl_state.cull_mode = cull));
+		a__gl_state.cull_mode = cull;
 	}
 
-	if (front != a__gl_state.front_face)
+	if (front != a__gl_state.front_face) {
 		AGL__CALL(glFrontFace(a__gl_state.front_face = front));
+		++a__gl_state.stats.cull_changes;
+	}
+}
+
+/* Invalidates attachments of the currently bound framebuffer */
+static void a__GLFramebufferInvalidate(GLsizei count, const GLenum *attachments) {
+	(void)count;
+	(void)attachments;
+#if defined(GL_VERSION_4_3) || defined(GL_ES_VERSION_3_0)
+	if (a_gl_capabilities.invalidate_framebuffer) {
+		AGL__CALL(glInvalidateFramebuffer(GL_FRAMEBUFFER, count, attachments));
+		return;
+	}
+#endif
+	if (a_gl_capabilities.discard_framebuffer)
+		AGL__CALL(a__gl_ext.DiscardFramebufferEXT(GL_FRAMEBUFFER, count, attachments));
 }
 
 static void a__GLFramebufferBind(const AGLFramebuffer *fbo) {
 	const GLuint desired_binding = fbo ? fbo->name : 0;
-	if (a__gl_state.framebuffer.binding != desired_binding)
+	if (a__gl_state.framebuffer.binding != desired_binding) {
 		AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, a__gl_state.framebuffer.binding = desired_binding));
+		++a__gl_state.stats.framebuffer_binds;
+	}
+}
+
+/* Sized internal format for multisampled color renderbuffers */
+static GLenum a__GLRenderbufferFormat(AGLTextureFormat format) {
+	switch (format) {
+#ifdef GL_RGBA8
+	case AGLTF_U8_RGB: return GL_RGB8;
+	case AGLTF_U8_RGBA: return GL_RGBA8;
+#endif
+#ifdef GL_RGB565
+	case AGLTF_U565_RGB: return GL_RGB565;
+#endif
+	case AGLTF_U5551_RGBA: return GL_RGB5_A1;
+	case AGLTF_U4444_RGBA: return GL_RGBA4;
+#ifdef GL_R32F
+	case AGLTF_F32_R: return GL_R32F;
+#endif
+#ifdef GL_RGBA32F
+	case AGLTF_F32_RGBA: return GL_RGBA32F;
+#endif
+	default: ATTO_ASSERT(!"Format can't be a multisampled render target"); return 0;
+	}
+}
+
+/* Allocates storage for the bound renderbuffer, implicit selects the
+ * GL_EXT_multisampled_render_to_texture flavor */
+static void a__GLRenderbufferStorage(GLsizei samples, int implicit, GLenum format, GLsizei width, GLsizei height) {
+	if (samples && implicit) {
+		AGL__CALL(a__gl_ext.RenderbufferStorageMultisampleEXT(GL_RENDERBUFFER, samples, format, width, height));
+		return;
+	}
+#ifdef GL_READ_FRAMEBUFFER
+	if (samples) {
+		AGL__CALL(glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, format, width, height));
+		return;
+	}
+#endif
+	AGL__CALL(glRenderbufferStorage(GL_RENDERBUFFER, format, width, height));
+}
+
+static void a__GLFramebufferAttachTexture(GLenum attachment, const AGLTexture *texture, GLsizei samples) {
+	if (samples) {
+		AGL__CALL(a__gl_ext.FramebufferTexture2DMultisampleEXT(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D,
+			texture->_.name, 0, samples));
+		return;
+	}
+	AGL__CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture->_.name, 0));
 }
 
 AGLFramebuffer aGLFramebufferCreate(AGLFramebufferCreate params) {
+	const AGLCapabilities *caps = &a_gl_capabilities;
 	AGLFramebuffer fbo = {0};
-	AGL__CALL(glGenFramebuffers(1, &fbo.name));
-	AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, fbo.name));
+	int implicit;
 
-	ATTO_ASSERT(params.color);
+	ATTO_ASSERT(params.color[0]);
+	fbo.width = params.color[0]->width;
+	fbo.height = params.color[0]->height;
+	if (params.samples > 1 && caps->max_samples)
+		fbo.samples = params.samples < caps->max_samples ? params.samples : caps->max_samples;
+	implicit = fbo.samples && caps->multisampled_render_to_texture;
+
+	AGL__CALL(glGenFramebuffers(1, &fbo.name));
+	a__GLFramebufferBind(&fbo);
+
+	while (fbo.colors < ATTO_GL_MAX_COLOR_ATTACHMENTS && params.color[fbo.colors]) {
+		const AGLTexture *color = params.color[fbo.colors];
+		const GLenum attachment = GL_COLOR_ATTACHMENT0 + fbo.colors;
+		ATTO_ASSERT(color->width == fbo.width && color->height == fbo.height);
+		if (fbo.samples && !implicit) {
+			GLuint *renderbuffer = fbo.color_renderbuffers + fbo.colors;
+			AGL__CALL(glGenRenderbuffers(1, renderbuffer));
+			AGL__CALL(glBindRenderbuffer(GL_RENDERBUFFER, *renderbuffer));
+			a__GLRenderbufferStorage(fbo.samples, 0, a__GLRenderbufferFormat(color->format), fbo.width, fbo.height);
+			AGL__CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, *renderbuffer));
+		} else {
+			a__GLFramebufferAttachTexture(attachment, color, fbo.samples);
+		}
+		++fbo.colors;
+	}
+	ATTO_ASSERT(fbo.colors <= caps->max_draw_buffers);
 
-	if (params.color)
-		AGL__CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, params.color->_.name, 0));
+#ifdef GL_MAX_DRAW_BUFFERS
+	if (caps->max_draw_buffers > 1) {
+		GLenum draw_buffers[ATTO_GL_MAX_COLOR_ATTACHMENTS];
+		for (int i = 0; i < fbo.colors; ++i)
+			draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+		AGL__CALL(glDrawBuffers(fbo.colors, draw_buffers));
+	}
+#endif
 
 	if (params.depth.enable) {
 		if (params.depth.texture) {
+			ATTO_ASSERT(!fbo.samples);
 			AGL__CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, params.depth.texture->_.name, 0));
 		} else {
 #ifdef ATTO_GLES
 			const GLenum depth_component = GL_DEPTH_COMPONENT16;
+#elif defined(GL_DEPTH_COMPONENT24)
+			/* Multisampled storage needs a sized format */
+			const GLenum depth_component = fbo.samples ? GL_DEPTH_COMPONENT24 : GL_DEPTH_COMPONENT;
 #else
 			const GLenum depth_component = GL_DEPTH_COMPONENT;
 #endif
 			AGL__CALL(glGenRenderbuffers(1, &fbo.depth_renderbuffer));
 			AGL__CALL(glBindRenderbuffer(GL_RENDERBUFFER, fbo.depth_renderbuffer));
-			AGL__CALL(glRenderbufferStorage(GL_RENDERBUFFER, depth_component, params.color->width, params.color->height));
+			a__GLRenderbufferStorage(fbo.samples, implicit, depth_component, fbo.width, fbo.height);
 			AGL__CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
 				GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fbo.depth_renderbuffer));
-			AGL__CALL(glBindRenderbuffer(GL_RENDERBUFFER, 0));
 		}
 	} else {
 		// Depth disabled
 		AGL__CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0));
 	}
+	AGL__CALL(glBindRenderbuffer(GL_RENDERBUFFER, 0));
 
-	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	ATTO_ASSERT(status == GL_FRAMEBUFFER_COMPLETE);
 
-	AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, a__gl_state.framebuffer.binding));
+	if (fbo.samples && !implicit) {
+		/* Only ever bound behind the state cache's back by aGLFramebufferResolve() */
+		AGL__CALL(glGenFramebuffers(1, &fbo.resolve));
+		AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, fbo.resolve));
+		for (int i = 0; i < fbo.colors; ++i)
+			a__GLFramebufferAttachTexture(GL_COLOR_ATTACHMENT0 + i, params.color[i], 0);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		ATTO_ASSERT(status == GL_FRAMEBUFFER_COMPLETE);
+		AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, fbo.name));
+	}
+
 	return fbo;
 }
 
@@ -1409,25 +4081,612 @@ void aGLFramebufferDestroy(AGLFramebuffer fbo) {
 	if (fbo.name) {
 		if (fbo.name == a__gl_state.framebuffer.binding)
 			AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, a__gl_state.framebuffer.binding = 0));
+		if (fbo.name == a__gl_state.framebuffer.target) {
+			a__gl_state.framebuffer.target = 0;
+			a__gl_state.framebuffer.discard_depth = 0;
+		}
 		glDeleteFramebuffers(1, &fbo.name);
 	}
 
 	if (fbo.depth_renderbuffer)
 		glDeleteRenderbuffers(1, &fbo.depth_renderbuffer);
+
+	for (int i = 0; i < fbo.colors; ++i)
+		if (fbo.color_renderbuffers[i])
+			glDeleteRenderbuffers(1, fbo.color_renderbuffers + i);
+
+	if (fbo.resolve) {
+		if (fbo.resolve == a__gl_state.framebuffer.binding)
+			AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, a__gl_state.framebuffer.binding = 0));
+		glDeleteFramebuffers(1, &fbo.resolve);
+	}
 }
 
-#if 0
-void aGLInvalidate(const AGLFramebuffer *fbo) {
+void aGLFramebufferResolve(const AGLFramebuffer *fbo) {
+#ifdef GL_READ_FRAMEBUFFER
+	GLenum draw_buffers[ATTO_GL_MAX_COLOR_ATTACHMENTS];
+
+	if (!fbo->resolve)
+		return;
+
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
 	a__GLFramebufferBind(fbo);
-	if (!fbo || fbo->name == 0) {
-		GLenum attachments[] = {GL_COLOR, GL_DEPTH};
-		glInvalidateFramebuffer(GL_FRAMEBUFFER, 2, attachments);
+	AGL__CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo->resolve));
+
+	/* One attachment at a time; GLES3 only allows draw buffer i to be GL_COLOR_ATTACHMENTi */
+	for (int i = 0; i < fbo->colors; ++i) {
+		draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+		AGL__CALL(glReadBuffer(draw_buffers[i]));
+		AGL__CALL(glDrawBuffers(i + 1, draw_buffers));
+		AGL__CALL(glBlitFramebuffer(0, 0, fbo->width, fbo->height, 0, 0, fbo->width, fbo->height,
+			GL_COLOR_BUFFER_BIT, GL_NEAREST));
+		draw_buffers[i] = GL_NONE;
+	}
+
+	AGL__CALL(glReadBuffer(GL_COLOR_ATTACHMENT0));
+	AGL__CALL(glBindFramebuffer(GL_FRAMEBUFFER, fbo->name));
+	a__gl_state.stats.framebuffer_binds += 2;
+#else
+	(void)fbo;
+#endif
+}
+
+static void a__GLRenderTargetFree(AGLRenderTarget *target) {
+	aGLFramebufferDestroy(target->framebuffer);
+	aGLTextureDestroy(&target->color);
+	memset(target, 0, sizeof(*target));
+}
+
+static int a__GLRenderTargetKeyEqual(const AGLRenderTargetKey *a, const AGLRenderTargetKey *b) {
+	return a->format == b->format && a->width == b->width && a->height == b->height && !a->depth == !b->depth &&
+		a->samples == b->samples;
+}
+
+AGLRenderTarget *aGLRenderTargetAcquire(AGLRenderTargetKey key) {
+	AGLRenderTarget *const targets = a__gl_state.render_targets.targets;
+	AGLRenderTarget *target = NULL;
+
+	for (int i = 0; i < ATTO_GL_RENDER_TARGET_POOL_SIZE; ++i) {
+		AGLRenderTarget *t = targets + i;
+		if (t->color._.name && !t->_.acquired && a__GLRenderTargetKeyEqual(&t->key, &key)) {
+			target = t;
+			break;
+		}
+	}
+
+	if (!target) {
+		/* Take an empty slot, or evict the least recently used idle target */
+		for (int i = 0; i < ATTO_GL_RENDER_TARGET_POOL_SIZE; ++i) {
+			AGLRenderTarget *t = targets + i;
+			if (!t->color._.name) {
+				target = t;
+				break;
+			}
+			if (!t->_.acquired && (!target || t->_.last_used < target->_.last_used))
+				target = t;
+		}
+		if (!target)
+			return NULL;
+		if (target->color._.name)
+			a__GLRenderTargetFree(target);
+
+		target->key = key;
+		target->color = aGLTextureCreate(&(AGLTextureData){
+			.type = AGLTT_2D,
+			.format = key.format,
+			.width = key.width,
+			.height = key.height,
+			.pixels = NULL,
+		});
+		target->color.wrap_s = target->color.wrap_t = AGLTW_Clamp;
+		target->framebuffer = aGLFramebufferCreate((AGLFramebufferCreate){
+			.color = {&target->color},
+			.depth = {
+				.enable = key.depth,
+				.texture = NULL,
+			},
+			.samples = key.samples,
+		});
+	}
+
+	target->_.acquired = 1;
+	target->_.last_used = a__gl_state.render_targets.frame;
+	return target;
+}
+
+void aGLRenderTargetPoolFrame(void) {
+	const unsigned frame = ++a__gl_state.render_targets.frame;
+	for (int i = 0; i < ATTO_GL_RENDER_TARGET_POOL_SIZE; ++i) {
+		AGLRenderTarget *t = a__gl_state.render_targets.targets + i;
+		t->_.acquired = 0;
+		if (t->color._.name && frame - t->_.last_used > ATTO_GL_RENDER_TARGET_POOL_FRAMES)
+			a__GLRenderTargetFree(t);
+	}
+}
+
+void aGLRenderTargetPoolClear(void) {
+	for (int i = 0; i < ATTO_GL_RENDER_TARGET_POOL_SIZE; ++i)
+		if (a__gl_state.render_targets.targets[i].color._.name)
+			a__GLRenderTargetFree(a__gl_state.render_targets.targets + i);
+}
+
+enum { A__GLAtlasSlotFree, A__GLAtlasSlotImage, A__GLAtlasSlotHole };
+
+/* Returns index + 1 of an unused region, 0 if there is none */
+static unsigned a__GLAtlasSlotTake(AGLAtlas *atlas) {
+	unsigned slot = atlas->_.free_regions;
+	if (slot)
+		atlas->_.free_regions = atlas->regions[slot - 1]._.next_free;
+	else if (atlas->_.regions < atlas->regions_capacity)
+		slot = ++atlas->_.regions;
+	else
+		return 0;
+
+	/* Slots past the count may be left over from before aGLAtlasClear() */
+	atlas->regions[slot - 1]._.state = A__GLAtlasSlotFree;
+	return slot;
+}
+
+static void a__GLAtlasSlotRelease(AGLAtlas *atlas, unsigned slot) {
+	AGLAtlasRegion *r = atlas->regions + slot - 1;
+	r->_.state = A__GLAtlasSlotFree;
+	r->_.next_free = atlas->_.free_regions;
+	atlas->_.free_regions = slot;
+}
+
+static AGLAtlasShelf *a__GLAtlasShelfFind(AGLAtlas *atlas, unsigned layer, unsigned y) {
+	for (unsigned i = 0; i < atlas->_.shelves; ++i)
+		if (atlas->shelves[i].layer == layer && atlas->shelves[i].y == y)
+			return atlas->shelves + i;
+	ATTO_ASSERT(!"Region doesn't belong to a shelf");
+	return NULL;
+}
+
+/* Whether a w x h image is worth putting on a shelf, too short ones waste its height */
+static int a__GLAtlasShelfFits(unsigned shelf_height, unsigned h) {
+	return shelf_height >= h && shelf_height <= h + h / 2;
+}
+
+static unsigned a__GLAtlasLayerTop(const AGLAtlas *atlas, unsigned layer) {
+	unsigned top = 0;
+	for (unsigned i = 0; i < atlas->_.shelves; ++i)
+		if (atlas->shelves[i].layer == layer && atlas->shelves[i].y + atlas->shelves[i].height > top)
+			top = atlas->shelves[i].y + atlas->shelves[i].height;
+	return top;
+}
+
+/* Places a padded w x h rectangle into image, returns 0 if there is no room */
+static int a__GLAtlasPlace(AGLAtlas *atlas, unsigned w, unsigned h, AGLAtlasRegion *image) {
+	AGLAtlasRegion *hole = NULL;
+	AGLAtlasShelf *shelf = NULL;
+
+	/* Space freed by removed images first, on the shortest shelf that fits */
+	for (unsigned i = 0; i < atlas->_.regions; ++i) {
+		AGLAtlasRegion *r = atlas->regions + i;
+		if (r->_.state == A__GLAtlasSlotHole && r->width >= w && a__GLAtlasShelfFits(r->height, h)
+			&& (!hole || r->height < hole->height))
+			hole = r;
+	}
+	if (hole) {
+		image->layer = hole->layer;
+		image->x = hole->x;
+		image->y = hole->y;
+		hole->x += w;
+		hole->width -= w;
+		if (!hole->width)
+			a__GLAtlasSlotRelease(atlas, (unsigned)(hole - atlas->regions) + 1);
+		++a__GLAtlasShelfFind(atlas, image->layer, image->y)->live;
+		return 1;
+	}
+
+	/* Then the free end of an existing shelf */
+	for (unsigned i = 0; i < atlas->_.shelves; ++i) {
+		AGLAtlasShelf *s = atlas->shelves + i;
+		if (s->used + w <= (unsigned)atlas->width && a__GLAtlasShelfFits(s->height, h)
+			&& (!shelf || s->height < shelf->height))
+			shelf = s;
+	}
+
+	/* Then a new shelf on top of the lowest layer with room for it */
+	if (!shelf && atlas->_.shelves < atlas->shelves_capacity) {
+		for (GLsizei layer = 0; layer < atlas->_.layers; ++layer) {
+			const unsigned top = a__GLAtlasLayerTop(atlas, (unsigned)layer);
+			if (top + h <= (unsigned)atlas->height) {
+				shelf = atlas->shelves + atlas->_.shelves++;
+				shelf->layer = (unsigned)layer;
+				shelf->y = top;
+				shelf->height = h;
+				shelf->used = shelf->live = 0;
+				break;
+			}
+		}
+	}
+
+	if (!shelf)
+		return 0;
+
+	image->layer = shelf->layer;
+	image->x = shelf->used;
+	image->y = shelf->y;
+	shelf->used += w;
+	++shelf->live;
+	return 1;
+}
+
+/* Doubles the layer count, copying the existing layers into the new texture */
+static void a__GLAtlasGrow(AGLAtlas *atlas) {
+	GLsizei layers = atlas->_.layers ? atlas->_.layers * 2 : 1;
+#ifndef GL_READ_FRAMEBUFFER
+	/* Layers can't be copied, allocate them all at once */
+	layers = atlas->max_layers;
+#endif
+	if (layers > atlas->max_layers)
+		layers = atlas->max_layers;
+
+	AGLTexture grown = aGLTextureCreate(&(AGLTextureData){
+		.type = AGLTT_2DArray,
+		.format = atlas->format,
+		.width = atlas->width,
+		.height = atlas->height,
+		.depth = layers,
+		.pixels = NULL,
+	});
+
+	if (atlas->_.layers) {
+#ifdef GL_READ_FRAMEBUFFER
+		GLuint fbo;
+		if (a__gl_state.command_buffer)
+			a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
+		AGL__CALL(glGenFramebuffers(1, &fbo));
+		AGL__CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo));
+		a__GLTextureUnitBind(a__gl_state.textures.active, AGLTT_2DArray, grown._.name);
+		for (GLsizei layer = 0; layer < atlas->_.layers; ++layer) {
+			AGL__CALL(glFramebufferTextureLayer(
+				GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, atlas->texture._.name, 0, layer));
+			AGL__CALL(glCopyTexSubImage3D(
+				GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, 0, 0, atlas->width, atlas->height));
+		}
+		AGL__CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, a__gl_state.framebuffer.binding));
+		AGL__CALL(glDeleteFramebuffers(1, &fbo));
+		a__gl_state.stats.framebuffer_binds += 2;
+#endif
+
+		grown.min_filter = atlas->texture.min_filter;
+		grown.mag_filter = atlas->texture.mag_filter;
+		grown.wrap_s = atlas->texture.wrap_s;
+		grown.wrap_t = atlas->texture.wrap_t;
+		grown.max_anisotropy = atlas->texture.max_anisotropy;
+		aGLTextureDestroy(&atlas->texture);
+	} else {
+		grown.wrap_s = grown.wrap_t = AGLTW_Clamp;
+	}
+
+	atlas->texture = grown;
+	atlas->_.layers = layers;
+}
+
+/* Uploads the image surrounded by padding texels that repeat its edges */
+static void a__GLAtlasUpload(AGLAtlas *atlas, const AGLAtlasRegion *r, const void *pixels) {
+	const struct A__GLTextureFormat tf = getTextureFormat(atlas->format);
+	const unsigned pad = atlas->padding;
+	const AGLTextureData data = {
+		.type = AGLTT_2DArray,
+		.format = atlas->format,
+		.width = (GLsizei)(r->width + 2 * pad),
+		.height = (GLsizei)(r->height + 2 * pad),
+		.depth = 1,
+	};
+	unsigned char *padded = NULL;
+
+	if (pad) {
+		const size_t pixel = (size_t)a__GLTextureFormatPixelSize(atlas->format);
+		const size_t src_stride = (pixel * r->width + 3) / 4 * 4;
+		const size_t dst_stride = (pixel * data.width + 3) / 4 * 4;
+		padded = malloc(aGLTextureDataSize(&data));
+		ATTO_ASSERT(padded);
+		for (unsigned y = 0; y < (unsigned)data.height; ++y) {
+			const unsigned sy = y < pad ? 0 : (y - pad < r->height ? y - pad : r->height - 1);
+			const unsigned char *src = (const unsigned char *)pixels + src_stride * sy;
+			unsigned char *dst = padded + dst_stride * y;
+			for (unsigned x = 0; x < pad; ++x) {
+				memcpy(dst + pixel * x, src, pixel);
+				memcpy(dst + pixel * (pad + r->width + x), src + pixel * (r->width - 1), pixel);
+			}
+			memcpy(dst + pixel * pad, src, pixel * r->width);
+		}
+		pixels = padded;
+	}
+
+	/* Not aGLTextureUpdate(), it takes updates at the origin for whole texture uploads */
+	a__GLTextureUnitBind(a__gl_state.textures.active, AGLTT_2DArray, atlas->texture._.name);
+	a__GLPixelUnpackBind(NULL);
+	AGL__CALL(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
+		(GLint)(r->x - pad), (GLint)(r->y - pad), (GLint)r->layer, data.width, data.height, 1,
+		tf.format, tf.type, pixels));
+	a__gl_state.stats.bytes_uploaded += aGLTextureDataSize(&data);
+	free(padded);
+}
+
+unsigned aGLAtlasAdd(AGLAtlas *atlas, unsigned width, unsigned height, const void *pixels) {
+	const unsigned w = width + 2 * atlas->padding, h = height + 2 * atlas->padding;
+	ATTO_ASSERT(width && height);
+	ATTO_ASSERT(!getTextureFormat(atlas->format).block_size);
+
+	if (w > (unsigned)atlas->width || h > (unsigned)atlas->height)
+		return 0;
+
+	const unsigned slot = a__GLAtlasSlotTake(atlas);
+	if (!slot)
+		return 0;
+
+	AGLAtlasRegion *r = atlas->regions + slot - 1;
+	while (!a__GLAtlasPlace(atlas, w, h, r)) {
+		if (atlas->_.layers >= atlas->max_layers || atlas->_.shelves >= atlas->shelves_capacity) {
+			a__GLAtlasSlotRelease(atlas, slot);
+			return 0;
+		}
+		a__GLAtlasGrow(atlas);
+	}
+
+	r->_.state = A__GLAtlasSlotImage;
+	r->x += atlas->padding;
+	r->y += atlas->padding;
+	r->width = width;
+	r->height = height;
+	r->u0 = (GLfloat)r->x / atlas->width;
+	r->v0 = (GLfloat)r->y / atlas->height;
+	r->u1 = (GLfloat)(r->x + width) / atlas->width;
+	r->v1 = (GLfloat)(r->y + height) / atlas->height;
+
+	if (pixels)
+		a__GLAtlasUpload(atlas, r, pixels);
+
+	return slot;
+}
+
+const AGLAtlasRegion *aGLAtlasGet(const AGLAtlas *atlas, unsigned handle) {
+	ATTO_ASSERT(handle && handle <= atlas->_.regions);
+	ATTO_ASSERT(atlas->regions[handle - 1]._.state == A__GLAtlasSlotImage);
+	return atlas->regions + handle - 1;
+}
+
+/* Frees every hole of an emptied shelf. Empty shelves at the top of the layer are dropped,
+ * so that its space can be taken by shelves of any height */
+static void a__GLAtlasShelfReset(AGLAtlas *atlas, AGLAtlasShelf *shelf) {
+	const unsigned layer = shelf->layer;
+
+	for (unsigned i = 0; i < atlas->_.regions; ++i) {
+		const AGLAtlasRegion *r = atlas->regions + i;
+		if (r->_.state == A__GLAtlasSlotHole && r->layer == layer && r->y == shelf->y)
+			a__GLAtlasSlotRelease(atlas, i + 1);
+	}
+	shelf->used = 0;
+
+	for (int dropped = 1; dropped;) {
+		const unsigned top = a__GLAtlasLayerTop(atlas, layer);
+		dropped = 0;
+		for (unsigned i = 0; i < atlas->_.shelves; ++i) {
+			AGLAtlasShelf *s = atlas->shelves + i;
+			if (s->layer == layer && !s->live && s->y + s->height == top) {
+				*s = atlas->shelves[--atlas->_.shelves];
+				dropped = 1;
+				break;
+			}
+		}
+	}
+}
+
+void aGLAtlasUpdate(AGLAtlas *atlas, unsigned handle, const void *pixels) {
+	ATTO_ASSERT(pixels);
+	a__GLAtlasUpload(atlas, aGLAtlasGet(atlas, handle), pixels);
+}
+
+void aGLAtlasRemove(AGLAtlas *atlas, unsigned handle) {
+	AGLAtlasRegion *r = (AGLAtlasRegion *)aGLAtlasGet(atlas, handle);
+	AGLAtlasShelf *shelf = a__GLAtlasShelfFind(atlas, r->layer, r->y - atlas->padding);
+
+	/* The freed space spans the whole height of its shelf */
+	r->_.state = A__GLAtlasSlotHole;
+	r->x -= atlas->padding;
+	r->y = shelf->y;
+	r->width += 2 * atlas->padding;
+	r->height = shelf->height;
+
+	if (!--shelf->live) {
+		a__GLAtlasShelfReset(atlas, shelf);
 		return;
 	}
 
-	ATTO_ASSERT(!"Not implemented");
+	/* Give space at the end back to the shelf, along with holes that end up there */
+	for (int absorbed = 1; absorbed;) {
+		absorbed = 0;
+		for (unsigned i = 0; i < atlas->_.regions; ++i) {
+			AGLAtlasRegion *hole = atlas->regions + i;
+			if (hole->_.state == A__GLAtlasSlotHole && hole->layer == shelf->layer && hole->y == shelf->y
+				&& hole->x + hole->width == shelf->used) {
+				shelf->used = hole->x;
+				a__GLAtlasSlotRelease(atlas, i + 1);
+				absorbed = 1;
+			}
+		}
+	}
+}
+
+void aGLAtlasClear(AGLAtlas *atlas) {
+	for (unsigned i = 0; i < atlas->_.regions; ++i)
+		atlas->regions[i]._.state = A__GLAtlasSlotFree;
+	atlas->_.shelves = 0;
+	atlas->_.regions = 0;
+	atlas->_.free_regions = 0;
+}
+
+void aGLAtlasDestroy(AGLAtlas *atlas) {
+	if (atlas->texture._.name)
+		aGLTextureDestroy(&atlas->texture);
+	atlas->_.layers = 0;
+	aGLAtlasClear(atlas);
+}
+
+static int a__GLReadbackAsync(void) {
+	const AGLCapabilities *caps = &a_gl_capabilities;
+	return caps->pixel_buffer && caps->sync && caps->map_buffer_range;
+}
+
+/* Frees the slot returned by the last poll */
+static void a__GLReadbackRelease(AGLReadback *readback) {
+	if (!readback->_.polled)
+		return;
+
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+	if (readback->slots[readback->_.first].buffer.name) {
+		a__GLBufferBind(GL_PIXEL_PACK_BUFFER, readback->slots[readback->_.first].buffer.name);
+		AGL__CALL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+	}
+#endif
+
+	readback->_.first = (readback->_.first + 1) % ATTO_GL_READBACK_SLOTS;
+	--readback->_.count;
+	readback->_.polled = 0;
+}
+
+int aGLReadbackBegin(AGLReadback *readback, const AGLFramebuffer *framebuffer, unsigned x, unsigned y,
+	unsigned width, unsigned height) {
+	const GLsizei size = (GLsizei)(width * height * 4);
+
+	if (readback->_.count == ATTO_GL_READBACK_SLOTS)
+		return 0;
+
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
+	/* Multisampled framebuffers are read from the textures they resolve into */
+	AGLFramebuffer resolved;
+	if (framebuffer && framebuffer->resolve) {
+		resolved = *framebuffer;
+		resolved.name = framebuffer->resolve;
+		framebuffer = &resolved;
+	}
+	a__GLFramebufferBind(framebuffer);
+
+	const unsigned index = (readback->_.first + readback->_.count) % ATTO_GL_READBACK_SLOTS;
+	readback->slots[index].width = width;
+	readback->slots[index].height = height;
+
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+	if (a__GLReadbackAsync()) {
+		AGLBuffer *buffer = &readback->slots[index].buffer;
+		if (!buffer->name) {
+			*buffer = aGLBufferCreate(AGLBT_PixelPack);
+			buffer->usage = AGLBU_StreamRead;
+		}
+		if (buffer->size < size)
+			aGLBufferUpload(buffer, size, NULL);
+
+		a__GLBufferBind(GL_PIXEL_PACK_BUFFER, buffer->name);
+		AGL__CALL(glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL));
+		readback->slots[index].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		++readback->_.count;
+		return 1;
+	}
+
+	if (a__gl_state.buffers.pixel_pack)
+		a__GLBufferBind(GL_PIXEL_PACK_BUFFER, 0);
+#endif
+
+	if (readback->slots[index].capacity < size) {
+		void *pixels = realloc(readback->slots[index].pixels, size);
+		if (!pixels)
+			return 0;
+		readback->slots[index].pixels = pixels;
+		readback->slots[index].capacity = size;
+	}
+
+	AGL__CALL(glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, readback->slots[index].pixels));
+	++readback->_.count;
+	return 1;
+}
+
+const void *aGLReadbackPoll(AGLReadback *readback, unsigned *width, unsigned *height) {
+	a__GLReadbackRelease(readback);
+	if (!readback->_.count)
+		return NULL;
+
+	const unsigned index = readback->_.first;
+	const void *pixels = readback->slots[index].pixels;
+
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+	if (readback->slots[index].fence) {
+		const GLsync fence = (GLsync)readback->slots[index].fence;
+		const GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		ATTO_ASSERT(status != GL_WAIT_FAILED);
+		if (status == GL_TIMEOUT_EXPIRED)
+			return NULL;
+
+		AGL__CALL(glDeleteSync(fence));
+		readback->slots[index].fence = NULL;
+
+		a__GLBufferBind(GL_PIXEL_PACK_BUFFER, readback->slots[index].buffer.name);
+		pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+			(GLsizeiptr)readback->slots[index].width * readback->slots[index].height * 4, GL_MAP_READ_BIT);
+		ATTO_ASSERT(pixels);
+	}
+#endif
+
+	*width = readback->slots[index].width;
+	*height = readback->slots[index].height;
+	readback->_.polled = 1;
+	return pixels;
 }
+
+void aGLReadbackDestroy(AGLReadback *readback) {
+	a__GLReadbackRelease(readback);
+	for (int i = 0; i < ATTO_GL_READBACK_SLOTS; ++i) {
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+		if (readback->slots[i].fence)
+			AGL__CALL(glDeleteSync((GLsync)readback->slots[i].fence));
 #endif
+		if (readback->slots[i].buffer.name)
+			aGLBufferDestroy(&readback->slots[i].buffer);
+		free(readback->slots[i].pixels);
+	}
+	memset(readback, 0, sizeof(*readback));
+}
+
+void aGLInvalidate(const AGLFramebuffer *fbo, AGLClearBits bits) {
+	GLenum attachments[ATTO_GL_MAX_COLOR_ATTACHMENTS + 1];
+	GLsizei count = 0;
+
+	if (!a_gl_capabilities.invalidate_framebuffer && !a_gl_capabilities.discard_framebuffer)
+		return;
+
+	if (a__gl_state.command_buffer)
+		a__GLCommandBufferFlush(a__gl_state.command_buffer);
+
+	if (fbo && fbo->name) {
+		if (bits & AGLCB_Color)
+			for (int i = 0; i < fbo->colors; ++i)
+				attachments[count++] = GL_COLOR_ATTACHMENT0 + i;
+		if (bits & AGLCB_Depth)
+			attachments[count++] = GL_DEPTH_ATTACHMENT;
+	} else {
+		if (bits & AGLCB_Color)
+			attachments[count++] = A__GL_DEFAULT_COLOR;
+		if (bits & AGLCB_Depth)
+			attachments[count++] = A__GL_DEFAULT_DEPTH;
+	}
+
+	if (!count)
+		return;
+
+	/* Depth is being invalidated right here, no need to do it again on unbind */
+	a__GLFramebufferBind(fbo);
+	if ((bits & AGLCB_Depth) && a__gl_state.framebuffer.target == (fbo ? fbo->name : 0))
+		a__gl_state.framebuffer.discard_depth = 0;
+	a__GLFramebufferInvalidate(count, attachments);
+}
 
 #if defined(__cplusplus)
 } /* extern "C" */
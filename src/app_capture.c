@@ -0,0 +1,431 @@
+/* Frame capture for the app loop.
+ *
+ * Setting ATTO_CAPTURE=<file> in the environment records every presented frame:
+ *  - "*.y4m" files get YUV 4:2:0 video (frame size is fixed by the first frame)
+ *  - anything else gets raw top-down RGBA8 frames back to back
+ *  - <file>.ts gets one "<frame> <timestamp us> <width> <height>" line per written frame
+ *
+ * Frames are read back through a ring of pixel pack buffers and fences where
+ * available (GL 3.2+, GLES 3.0+), with a synchronous glReadPixels fallback.
+ * Pixels are then handed to a worker thread through a bounded queue; the
+ * worker does the conversion and all the file I/O. When the queue is full
+ * frames are dropped, or the render thread waits for the worker if
+ * ATTO_CAPTURE_POLICY=block.
+ */
+
+#ifdef ATTO_GLES
+#include <GLES2/gl2.h>
+#else
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ATTO_APP_CAPTURE_READBACKS
+#define ATTO_APP_CAPTURE_READBACKS 3
+#endif
+
+#ifndef ATTO_APP_CAPTURE_QUEUE
+#define ATTO_APP_CAPTURE_QUEUE 8
+#endif
+
+/* Nominal frame rate written to the y4m header; real times are in the .ts file */
+#ifndef ATTO_APP_CAPTURE_FPS
+#define ATTO_APP_CAPTURE_FPS 60
+#endif
+
+#if defined(GL_PIXEL_PACK_BUFFER) && defined(GL_SYNC_GPU_COMMANDS_COMPLETE)
+#define A__CAPTURE_ASYNC
+#endif
+
+typedef struct {
+	unsigned char *pixels;
+	size_t capacity;
+	unsigned int width, height;
+	unsigned int frame;
+	ATimeUs timestamp;
+} a__CaptureFrame;
+
+static struct {
+	int enabled;
+	int block;
+	int y4m;
+	FILE *video, *timestamps;
+	unsigned int frame, written, dropped;
+
+#ifdef A__CAPTURE_ASYNC
+	int async;
+	struct {
+		GLuint buffer;
+		GLsync fence;
+		GLsizeiptr capacity;
+		unsigned int width, height;
+		unsigned int frame;
+		ATimeUs timestamp;
+	} readbacks[ATTO_APP_CAPTURE_READBACKS];
+	unsigned int first, count;
+#endif
+
+	/* Owned by the worker thread */
+	unsigned int y4m_width, y4m_height;
+	unsigned char *planes;
+	size_t planes_capacity;
+
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t filled, drained;
+	/* Frames [head, head + queued) belong to the worker, the rest to the render thread */
+	a__CaptureFrame queue[ATTO_APP_CAPTURE_QUEUE];
+	unsigned int head, queued;
+	int stop;
+} a__capture;
+
+static int a__captureReserve(unsigned char **buffer, size_t *capacity, size_t size) {
+	unsigned char *grown;
+	if (*capacity >= size)
+		return 1;
+	if (!(grown = realloc(*buffer, size)))
+		return 0;
+	*buffer = grown;
+	*capacity = size;
+	return 1;
+}
+
+static unsigned char a__captureClamp(int value) {
+	return value < 0 ? 0 : value > 255 ? 255 : (unsigned char)value;
+}
+
+/* BT.601 full range, matching the C420jpeg colorspace tag */
+static void a__captureWriteY4M(const a__CaptureFrame *f) {
+	const unsigned int w = f->width, h = f->height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+	const size_t stride = (size_t)w * 4;
+	unsigned char *y, *u, *v;
+
+	y = a__capture.planes;
+	u = y + (size_t)w * h;
+	v = u + (size_t)cw * ch;
+
+	for (unsigned int row = 0; row < h; ++row) {
+		const unsigned char *src = f->pixels + (h - 1 - row) * stride;
+		for (unsigned int col = 0; col < w; ++col, src += 4)
+			y[row * w + col] = a__captureClamp((77 * src[0] + 150 * src[1] + 29 * src[2] + 128) >> 8);
+	}
+
+	for (unsigned int row = 0; row < ch; ++row) {
+		const unsigned int r0 = h - 1 - row * 2, r1 = r0 ? r0 - 1 : r0;
+		for (unsigned int col = 0; col < cw; ++col) {
+			const unsigned int c0 = col * 2, c1 = c0 + 1 < w ? c0 + 1 : c0;
+			const unsigned char *p[4] = {
+				f->pixels + r0 * stride + c0 * 4,
+				f->pixels + r0 * stride + c1 * 4,
+				f->pixels + r1 * stride + c0 * 4,
+				f->pixels + r1 * stride + c1 * 4,
+			};
+			const int r = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) / 4;
+			const int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) / 4;
+			const int b = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) / 4;
+			u[row * cw + col] = a__captureClamp((-43 * r - 85 * g + 128 * b + 32896) >> 8);
+			v[row * cw + col] = a__captureClamp((128 * r - 107 * g - 21 * b + 32896) >> 8);
+		}
+	}
+
+	fputs("FRAME\n", a__capture.video);
+	fwrite(a__capture.planes, 1, (size_t)w * h + (size_t)cw * ch * 2, a__capture.video);
+}
+
+static void a__captureWrite(const a__CaptureFrame *f) {
+	if (a__capture.y4m) {
+		const unsigned int w = f->width, h = f->height;
+		if (!a__capture.y4m_width) {
+			const size_t size = (size_t)w * h + (size_t)((w + 1) / 2) * ((h + 1) / 2) * 2;
+			if (!a__captureReserve(&a__capture.planes, &a__capture.planes_capacity, size))
+				return;
+			fprintf(a__capture.video, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", w, h, ATTO_APP_CAPTURE_FPS);
+			a__capture.y4m_width = w;
+			a__capture.y4m_height = h;
+		}
+
+		/* y4m can't change frame size mid-stream */
+		if (w != a__capture.y4m_width || h != a__capture.y4m_height)
+			return;
+
+		a__captureWriteY4M(f);
+	} else {
+		const size_t stride = (size_t)f->width * 4;
+		for (unsigned int row = f->height; row > 0; --row)
+			fwrite(f->pixels + (row - 1) * stride, 1, stride, a__capture.video);
+	}
+
+	fprintf(a__capture.timestamps, "%u %u %u %u\n", f->frame, f->timestamp, f->width, f->height);
+	++a__capture.written;
+}
+
+static void *a__captureWorker(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&a__capture.lock);
+	for (;;) {
+		while (!a__capture.queued && !a__capture.stop)
+			pthread_cond_wait(&a__capture.filled, &a__capture.lock);
+		if (!a__capture.queued)
+			break;
+
+		pthread_mutex_unlock(&a__capture.lock);
+		a__captureWrite(a__capture.queue + a__capture.head);
+		pthread_mutex_lock(&a__capture.lock);
+
+		a__capture.head = (a__capture.head + 1) % ATTO_APP_CAPTURE_QUEUE;
+		--a__capture.queued;
+		pthread_cond_signal(&a__capture.drained);
+	}
+	pthread_mutex_unlock(&a__capture.lock);
+	return NULL;
+}
+
+/* Returns a free queue frame able to hold size bytes, or NULL if the frame should be dropped */
+static a__CaptureFrame *a__captureAcquire(size_t size) {
+	a__CaptureFrame *f = NULL;
+
+	pthread_mutex_lock(&a__capture.lock);
+	while (a__capture.block && a__capture.queued == ATTO_APP_CAPTURE_QUEUE)
+		pthread_cond_wait(&a__capture.drained, &a__capture.lock);
+	if (a__capture.queued < ATTO_APP_CAPTURE_QUEUE)
+		f = a__capture.queue + (a__capture.head + a__capture.queued) % ATTO_APP_CAPTURE_QUEUE;
+	pthread_mutex_unlock(&a__capture.lock);
+
+	if (f && !a__captureReserve(&f->pixels, &f->capacity, size))
+		f = NULL;
+	if (!f)
+		++a__capture.dropped;
+	return f;
+}
+
+/* Hands the frame returned by the last a__captureAcquire() to the worker */
+static void a__captureSubmit(void) {
+	pthread_mutex_lock(&a__capture.lock);
+	++a__capture.queued;
+	pthread_cond_signal(&a__capture.filled);
+	pthread_mutex_unlock(&a__capture.lock);
+}
+
+#ifdef A__CAPTURE_ASYNC
+static int a__captureAsyncSupported(void) {
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major = 0, minor = 0, es;
+	if (!version)
+		return 0;
+	es = !!strstr(version, "OpenGL ES");
+	while (*version && (*version < '0' || *version > '9'))
+		++version;
+	if (sscanf(version, "%d.%d", &major, &minor) != 2)
+		return 0;
+	return es ? major >= 3 : major > 3 || (major == 3 && minor >= 2);
+}
+
+/* Moves finished readbacks into the queue; with wait set drains all of them */
+static void a__captureCollect(int wait) {
+	while (a__capture.count) {
+		const unsigned int index = a__capture.first;
+		const GLenum status = glClientWaitSync(a__capture.readbacks[index].fence,
+			wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+		const unsigned int w = a__capture.readbacks[index].width, h = a__capture.readbacks[index].height;
+		const size_t size = (size_t)w * h * 4;
+		a__CaptureFrame *f;
+
+		if (status == GL_TIMEOUT_EXPIRED)
+			break;
+
+		glDeleteSync(a__capture.readbacks[index].fence);
+		a__capture.readbacks[index].fence = 0;
+		a__capture.first = (index + 1) % ATTO_APP_CAPTURE_READBACKS;
+		--a__capture.count;
+
+		if (status == GL_WAIT_FAILED || !(f = a__captureAcquire(size)))
+			continue;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, a__capture.readbacks[index].buffer);
+		{
+			const void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)size, GL_MAP_READ_BIT);
+			if (!pixels) {
+				++a__capture.dropped;
+				continue;
+			}
+			memcpy(f->pixels, pixels, size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+
+		f->width = w;
+		f->height = h;
+		f->frame = a__capture.readbacks[index].frame;
+		f->timestamp = a__capture.readbacks[index].timestamp;
+		a__captureSubmit();
+	}
+}
+
+static void a__captureReadAsync(ATimeUs timestamp, unsigned int w, unsigned int h) {
+	const GLsizeiptr size = (GLsizeiptr)w * h * 4;
+	unsigned int index;
+
+	a__captureCollect(0);
+	if (a__capture.count == ATTO_APP_CAPTURE_READBACKS) {
+		if (!a__capture.block) {
+			++a__capture.dropped;
+			return;
+		}
+		a__captureCollect(1);
+	}
+
+	index = (a__capture.first + a__capture.count) % ATTO_APP_CAPTURE_READBACKS;
+	if (!a__capture.readbacks[index].buffer)
+		glGenBuffers(1, &a__capture.readbacks[index].buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, a__capture.readbacks[index].buffer);
+	if (a__capture.readbacks[index].capacity < size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		a__capture.readbacks[index].capacity = size;
+	}
+
+	glReadPixels(0, 0, (GLsizei)w, (GLsizei)h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	a__capture.readbacks[index].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	a__capture.readbacks[index].width = w;
+	a__capture.readbacks[index].height = h;
+	a__capture.readbacks[index].frame = a__capture.frame;
+	a__capture.readbacks[index].timestamp = timestamp;
+	++a__capture.count;
+}
+#endif /* ifdef A__CAPTURE_ASYNC */
+
+static void a__captureReadSync(ATimeUs timestamp, unsigned int w, unsigned int h) {
+	a__CaptureFrame *f = a__captureAcquire((size_t)w * h * 4);
+	if (!f)
+		return;
+
+	glReadPixels(0, 0, (GLsizei)w, (GLsizei)h, GL_RGBA, GL_UNSIGNED_BYTE, f->pixels);
+	f->width = w;
+	f->height = h;
+	f->frame = a__capture.frame;
+	f->timestamp = timestamp;
+	a__captureSubmit();
+}
+
+/* Must be called with the GL context current */
+static void a__captureInit(void) {
+	const char *path = getenv("ATTO_CAPTURE"), *policy = getenv("ATTO_CAPTURE_POLICY");
+	char ts_path[1024];
+	size_t length;
+
+	if (!path || !*path)
+		return;
+
+	length = strlen(path);
+	if (length + sizeof(".ts") > sizeof(ts_path)) {
+		aAppDebugPrintf("capture: path too long: %s", path);
+		return;
+	}
+	memcpy(ts_path, path, length);
+	memcpy(ts_path + length, ".ts", sizeof(".ts"));
+
+	a__capture.y4m = length >= 4 && strcmp(path + length - 4, ".y4m") == 0;
+	a__capture.block = policy && strcmp(policy, "block") == 0;
+
+	if (!(a__capture.video = fopen(path, "wb")) || !(a__capture.timestamps = fopen(ts_path, "w"))) {
+		aAppDebugPrintf("capture: cannot open %s", a__capture.video ? ts_path : path);
+		if (a__capture.video)
+			fclose(a__capture.video);
+		a__capture.video = NULL;
+		return;
+	}
+
+	pthread_mutex_init(&a__capture.lock, NULL);
+	pthread_cond_init(&a__capture.filled, NULL);
+	pthread_cond_init(&a__capture.drained, NULL);
+	if (pthread_create(&a__capture.worker, NULL, a__captureWorker, NULL) != 0) {
+		aAppDebugPrintf("capture: cannot start worker thread");
+		fclose(a__capture.video);
+		fclose(a__capture.timestamps);
+		return;
+	}
+
+#ifdef A__CAPTURE_ASYNC
+	a__capture.async = a__captureAsyncSupported();
+#endif
+
+	a__capture.enabled = 1;
+	aAppDebugPrintf("capture: recording to %s (%s, %s)", path, a__capture.y4m ? "y4m" : "rgba",
+		a__capture.block ? "block" : "drop");
+}
+
+/* Reads back the default framebuffer; call after paint and before swapping */
+static void a__captureFrame(ATimeUs timestamp, unsigned int w, unsigned int h) {
+	GLint framebuffer = 0, alignment = 4;
+#ifdef A__CAPTURE_ASYNC
+	GLint pack_buffer = 0;
+#endif
+
+	if (!a__capture.enabled || !w || !h)
+		return;
+
+	/* Leave GL bindings as the application had them, so that gl.h caches stay valid */
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+	glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+	if (framebuffer)
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (alignment != 4)
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+#ifdef A__CAPTURE_ASYNC
+	if (a__capture.async) {
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+		a__captureReadAsync(timestamp, w, h);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, (GLuint)pack_buffer);
+	} else
+#endif
+		a__captureReadSync(timestamp, w, h);
+
+	if (framebuffer)
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)framebuffer);
+	if (alignment != 4)
+		glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+
+	++a__capture.frame;
+}
+
+/* Flushes outstanding frames to disk; must be called with the GL context still current */
+static void a__captureDestroy(void) {
+	if (!a__capture.enabled)
+		return;
+	a__capture.enabled = 0;
+
+#ifdef A__CAPTURE_ASYNC
+	if (a__capture.async) {
+		GLint pack_buffer = 0;
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+		a__captureCollect(1);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, (GLuint)pack_buffer);
+		for (int i = 0; i < ATTO_APP_CAPTURE_READBACKS; ++i)
+			if (a__capture.readbacks[i].buffer)
+				glDeleteBuffers(1, &a__capture.readbacks[i].buffer);
+	}
+#endif
+
+	pthread_mutex_lock(&a__capture.lock);
+	a__capture.stop = 1;
+	pthread_cond_signal(&a__capture.filled);
+	pthread_mutex_unlock(&a__capture.lock);
+	pthread_join(a__capture.worker, NULL);
+
+	fclose(a__capture.video);
+	fclose(a__capture.timestamps);
+	for (int i = 0; i < ATTO_APP_CAPTURE_QUEUE; ++i)
+		free(a__capture.queue[i].pixels);
+	free(a__capture.planes);
+
+	pthread_cond_destroy(&a__capture.drained);
+	pthread_cond_destroy(&a__capture.filled);
+	pthread_mutex_destroy(&a__capture.lock);
+
+	aAppDebugPrintf("capture: %u frames presented, %u written, %u dropped", a__capture.frame,
+		a__capture.written, a__capture.dropped);
+}
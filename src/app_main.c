@@ -20,7 +20,10 @@ static void a__inputDestroy(void) {}
 #define a__videoDestroy a__kmsDestroy
 #endif
 
+#include "app_capture.c"
+
 static void deinit(void) {
+	a__captureDestroy();
 	a__inputDestroy();
 	a__videoDestroy();
 }
@@ -34,6 +37,8 @@ int main(int argc, char *argv[]) {
 
 	a__global_state.gl_version = AOGLV_ES_20;
 
+	a__captureInit();
+
 	ATimeUs timestamp = aAppTime();
 	ATTO_APP_INIT_FUNC(&a__app_proctable);
 
@@ -53,6 +58,8 @@ int main(int argc, char *argv[]) {
 		if (a__app_proctable.paint)
 			a__app_proctable.paint(now, dt);
 
+		a__captureFrame(now, a__global_state.width, a__global_state.height);
+
 		a__videoSwap();
 		last_paint = now;
 	}
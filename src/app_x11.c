@@ -27,12 +27,15 @@
 #include <string.h>
 #include <stdlib.h> /* exit() */
 
+#include "app_capture.c"
+
 static struct AAppState a__app_state;
 const struct AAppState *a_app_state = &a__app_state;
 
 static struct AAppProctable a__app_proctable;
 
 void aAppTerminate(int code) {
+	a__captureDestroy();
 	exit(code);
 }
 
@@ -251,6 +254,7 @@ int main(int argc, char *argv[]) {
 #endif
 	XVisualInfo *vinfo = NULL;
 	ATimeUs last_paint = 0;
+	unsigned int configured_width = ATTO_APP_WIDTH, configured_height = ATTO_APP_HEIGHT;
 
 	ATTO_ASSERT(a__x11.display = XOpenDisplay(NULL));
 
@@ -344,6 +348,7 @@ int main(int argc, char *argv[]) {
 	a__app_state.width = ATTO_APP_WIDTH;
 	a__app_state.height = ATTO_APP_HEIGHT;
 
+	a__captureInit();
 	ATTO_APP_INIT_FUNC(&a__app_proctable);
 
 	if (a__app_proctable.resize)
@@ -354,20 +359,11 @@ int main(int argc, char *argv[]) {
 			XEvent e;
 			XNextEvent(a__x11.display, &e);
 			switch (e.type) {
-			case ConfigureNotify: {
-				unsigned int oldw = a__app_state.width, oldh = a__app_state.height;
-
-				if (a__app_state.width == (unsigned int)e.xconfigure.width &&
-					a__app_state.height == (unsigned int)e.xconfigure.height)
-					break;
-
-				a__app_state.width = e.xconfigure.width;
-				a__app_state.height = e.xconfigure.height;
-				timestamp = aAppTime();
-
-				if (a__app_proctable.resize)
-					a__app_proctable.resize(timestamp, oldw, oldh);
-			} break;
+			/* Window drags send bursts of these, only the last size is reported, once per frame */
+			case ConfigureNotify:
+				configured_width = e.xconfigure.width;
+				configured_height = e.xconfigure.height;
+				break;
 
 			case ButtonPress:
 			case ButtonRelease: a__appProcessXButton(&e); break;
@@ -381,6 +377,17 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
+		if (a__app_state.width != configured_width || a__app_state.height != configured_height) {
+			unsigned int oldw = a__app_state.width, oldh = a__app_state.height;
+
+			a__app_state.width = configured_width;
+			a__app_state.height = configured_height;
+			timestamp = aAppTime();
+
+			if (a__app_proctable.resize)
+				a__app_proctable.resize(timestamp, oldw, oldh);
+		}
+
 		{
 			ATimeUs now = aAppTime();
 			float dt;
@@ -391,6 +398,8 @@ int main(int argc, char *argv[]) {
 			if (a__app_proctable.paint)
 				a__app_proctable.paint(now, dt);
 
+			a__captureFrame(now, a__app_state.width, a__app_state.height);
+
 #ifndef ATTO_EGL
 			glXSwapBuffers(a__x11.display, a__x11.drawable);
 #else
@@ -404,6 +413,8 @@ exit:
 	if (a__app_proctable.close)
 		a__app_proctable.close();
 
+	a__captureDestroy();
+
 	aAppDebugPrintf("cleaning up");
 #ifndef ATTO_EGL
 	glXMakeContextCurrent(a__x11.display, 0, 0, 0);